@@ -0,0 +1,563 @@
+// Copyright (c) 2009, Florian Wagner <florian@wagner-flo.net>.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Benchmarks for inipp. Run all with "./bench" or pick some by name,
+// e.g. "./bench readers".
+
+#include <inipp.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace
+{
+  typedef std::chrono::steady_clock bclock;
+
+  // synthetic config with the given number of sections and keys each
+  std::string make_config(int sections, int keys) {
+    std::string out;
+
+    for(int s = 0; s < sections; ++s) {
+      out += "[section " + std::to_string(s) + "]\n";
+      for(int k = 0; k < keys; ++k) {
+        out += "key " + std::to_string(k) + " = value " +
+               std::to_string(s * keys + k) + "\n";
+      }
+    }
+
+    return out;
+  }
+
+  // Runs op (which returns the number of operations it did) on 1 to
+  // hardware_concurrency threads for half a second each and prints the
+  // throughput.
+  void scale_threads(const char* what,
+                     const std::function<std::uint64_t(unsigned)>& op) {
+    const unsigned maxthreads =
+      std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned nthreads = 1; ;
+        nthreads = std::min(nthreads * 2, maxthreads)) {
+      // keep counters on separate cache lines
+      struct alignas(64) counter { std::uint64_t ops; };
+      std::vector<counter> counters(nthreads);
+      std::atomic<bool> stop(false);
+      std::vector<std::thread> threads;
+
+      for(unsigned t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&, t]() {
+          std::uint64_t ops = 0;
+          unsigned i = t * 7919;
+
+          while(!stop.load(std::memory_order_relaxed)) {
+            ops += op(i);
+            i += 256;
+          }
+
+          counters[t].ops = ops;
+        });
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      stop = true;
+      for(std::thread& thread : threads) {
+        thread.join();
+      }
+
+      std::uint64_t total = 0;
+      for(const counter& c : counters) {
+        total += c.ops;
+      }
+
+      std::printf("  %3u threads: %12.0f %s/s total, %12.0f per thread\n",
+                  nthreads, total / 0.5, what, total / 0.5 / nthreads);
+
+      if(nthreads == maxthreads) {
+        break;
+      }
+    }
+  }
+
+  // Shared inifile read from 1 to hardware_concurrency threads. Per
+  // thread throughput should stay flat; a drop points to false sharing
+  // or writes hidden in const lookups.
+  void bench_readers() {
+    const int sections = 64;
+    const int keys = 64;
+    std::istringstream in(make_config(sections, keys));
+    const inipp::inifile cfile(in);
+
+    std::vector<std::string> names;
+    for(int s = 0; s < sections; ++s) {
+      names.push_back("section " + std::to_string(s));
+    }
+    std::vector<std::string> keynames;
+    for(int k = 0; k < keys; ++k) {
+      keynames.push_back("key " + std::to_string(k));
+    }
+
+    std::printf("readers: %d entries, %u hardware threads\n",
+                sections * keys, std::thread::hardware_concurrency());
+
+    scale_threads("gets", [&](unsigned i) {
+      std::uint64_t ops = 0;
+      for(int j = 0; j < 256; ++j, ++i) {
+        const std::string& sec = names[i % sections];
+        const std::string& key = keynames[(i / sections) % keys];
+        ops += cfile.get(sec, key).size() != 0;
+      }
+      return ops;
+    });
+  }
+
+  // Access to a published config: mutex and shared_ptr copy per read
+  // versus the per-thread snapshots of inipp::reloadable.
+  void bench_snapshot() {
+    std::istringstream in(make_config(1, 16));
+    std::shared_ptr<const inipp::inifile> shared =
+      std::make_shared<const inipp::inifile>(in);
+    std::mutex mutex;
+    inipp::reloadable holder(shared);
+
+    std::printf("snapshot: mutex + shared_ptr\n");
+    scale_threads("reads", [&](unsigned) {
+      std::uint64_t ops = 0;
+      for(int j = 0; j < 256; ++j) {
+        std::shared_ptr<const inipp::inifile> cfg;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          cfg = shared;
+        }
+        ops += cfg->version() == 0;
+      }
+      return ops;
+    });
+
+    std::printf("snapshot: inipp::reloadable\n");
+    scale_threads("reads", [&](unsigned) {
+      std::uint64_t ops = 0;
+      for(int j = 0; j < 256; ++j) {
+        ops += holder.current().version() == 0;
+      }
+      return ops;
+    });
+  }
+
+  // Seconds fn takes to run.
+  double seconds(const std::function<void()>& fn) {
+    bclock::time_point start = bclock::now();
+    fn();
+    return std::chrono::duration<double>(bclock::now() - start).count();
+  }
+
+  // Random (section, key) lookups, one get at a time versus bulk
+  // lookup() in batches of 4096, on configs from cache sized to much
+  // larger than the caches, from maps and from an attached image.
+  void bench_bulk() {
+    const std::size_t lookups = 1 << 18;
+    const std::size_t batch = 4096;
+
+    std::printf("bulk: %zu random lookups, batches of %zu\n", lookups, batch);
+
+    for(int entries : { 1000, 100000, 1000000 }) {
+      const int keys = 100;
+      const int sections = entries / keys;
+      std::istringstream in(make_config(sections, keys));
+      const inipp::inifile cfile(in);
+
+      std::vector<std::uint64_t> buf(cfile.image_size() / 8);
+      cfile.write_image(buf.data());
+      const inipp::inifile image =
+        inipp::inifile::attach(buf.data(), cfile.image_size());
+
+      std::vector<std::string> names;
+      std::uint64_t x = 88172645463325252ULL;
+      for(std::size_t i = 0; i < lookups; ++i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        names.push_back("section " + std::to_string(x % sections));
+        names.push_back("key " + std::to_string((x >> 32) % keys));
+      }
+      std::vector<inipp::key_ref> refs;
+      for(std::size_t i = 0; i < names.size(); i += 2) {
+        refs.push_back({ names[i], names[i + 1] });
+      }
+
+      for(const inipp::inifile* cfg : { &cfile, &image }) {
+        const char* kind = (cfg == &image) ? "image" : "maps";
+        std::size_t found = 0;
+
+        double get = seconds([&]() {
+          for(std::size_t i = 0; i < names.size(); i += 2) {
+            found += cfg->get(names[i], names[i + 1]).size() != 0;
+          }
+        });
+
+        double bulk = seconds([&]() {
+          std::vector<inipp::key_ref> part;
+          for(std::size_t i = 0; i < refs.size(); i += batch) {
+            part.assign(refs.begin() + i,
+                        refs.begin() + std::min(i + batch, refs.size()));
+            for(const auto& value : cfg->lookup(part)) {
+              found += value && !value->empty();
+            }
+          }
+        });
+
+        std::printf("  %7d entries, %-5s get: %7.2f M/s, lookup: %7.2f M/s "
+                    "(%.2fx)\n", entries, kind, lookups / get / 1e6,
+                    lookups / bulk / 1e6, get / bulk);
+        if(found != 2 * lookups) {
+          std::printf("  unexpected misses\n");
+        }
+      }
+    }
+  }
+
+  // getval<int> and getval<double> parsing the text each time versus
+  // values classified while loading, and the cost of classifying.
+  void bench_typed() {
+    const int keys = 1000;
+    std::string text = "[numbers]\n";
+    for(int k = 0; k < keys; ++k) {
+      text += "int " + std::to_string(k) + " = " + std::to_string(k * 7919) +
+              "\nfloat " + std::to_string(k) + " = " +
+              std::to_string(k * 0.37) + "\n";
+    }
+
+    inipp::parse_options options;
+    std::vector<std::string> names;
+    for(int k = 0; k < keys; ++k) {
+      names.push_back("int " + std::to_string(k));
+      names.push_back("float " + std::to_string(k));
+    }
+
+    std::printf("typed: %d integers and %d doubles\n", keys, keys);
+
+    for(bool typed : { false, true }) {
+      options.typed_values = typed;
+      std::istringstream in(text);
+      std::optional<inipp::inifile> cfile;
+      const double load = seconds([&]() { cfile.emplace(in, options); });
+
+      double sum = 0;
+      const int rounds = 20;
+      const double get = seconds([&]() {
+        for(int r = 0; r < rounds; ++r) {
+          for(std::size_t i = 0; i < names.size(); i += 2) {
+            sum += cfile->getval("numbers", names[i], 0);
+            sum += cfile->getval("numbers", names[i + 1], 0.0);
+          }
+        }
+      });
+
+      std::printf("  %-5s load: %7.2f ms, getval: %7.1f ns (sum %.0f)\n",
+                  typed ? "typed" : "text", load * 1e3,
+                  get / (rounds * names.size()) * 1e9, sum);
+    }
+  }
+
+  // Load throughput of an inifile from memory, best of several rounds:
+  // a plain file with the default options, with provenance tracking,
+  // with UTF-8 validation and sized by an earlier load of the same file
+  // (printing the rehashes while loading), a comment-heavy file
+  // (documented defaults, commented out entries), also validated, a
+  // whitespace-heavy one (indentation and aligned columns) and one with
+  // non-ASCII values.
+  void bench_parse() {
+    std::string commented, padded, unicode;
+
+    for(int s = 0; s < 1000; ++s) {
+      commented += "# section " + std::to_string(s) + "\n[section " +
+                   std::to_string(s) + "]  ; generated\n";
+      padded += "\n  [ section " + std::to_string(s) + " ]\n\n";
+      for(int k = 0; k < 100; ++k) {
+        const std::string key = "key " + std::to_string(k);
+        const std::string value = "value " + std::to_string(s * 100 + k);
+        commented += "# " + key + " sets the value of the key, see the "
+                     "manual for details\n;" + key + " = old " + value +
+                     "\n" + key + " = " + value + "  # current\n";
+        padded += "\t    " + key + std::string(16 - key.size(), ' ') +
+                  "   =   " + value + std::string(24 - value.size(), ' ') +
+                  "\t\n";
+        unicode += key + " = gr\xC3\xBC\xC3\x9F " + value +
+                   " \xE2\x82\xAC \xF0\x9F\x98\x80\n";
+      }
+    }
+
+    const struct
+    {
+      const char* name;
+      std::string text;
+      bool track;
+      bool utf8;
+      bool hinted;
+    } inputs[] = {
+      { "plain", make_config(1000, 100), false, false, false },
+      { "origins", make_config(1000, 100), true, false, false },
+      { "utf-8", make_config(1000, 100), false, true, false },
+      { "hinted", make_config(1000, 100), false, false, true },
+      { "comments", commented, false, false, false },
+      { "utf-8", commented, false, true, false },
+      { "spaces", padded, false, false, false },
+      { "unicode", unicode, false, false, false },
+      { "utf-8", unicode, false, true, false },
+    };
+    const int rounds = 10;
+
+    std::printf("parse: 100000 entries\n");
+
+    for(const auto& input : inputs) {
+      inipp::parse_options options;
+      options.track_origins = input.track;
+      options.validate_utf8 = input.utf8;
+      double best = 1e9;
+      std::optional<inipp::inifile> cfile;
+
+      for(int r = 0; r < rounds; ++r) {
+        std::istringstream in(input.text);
+        std::optional<inipp::inifile> previous = std::move(cfile);
+        options.size_hint = (input.hinted && previous) ? &*previous
+                                                       : nullptr;
+        best = std::min(best, seconds([&]() { cfile.emplace(in, options); }));
+      }
+
+      const inipp::load_stats& stats = cfile->stats();
+      std::printf("  %-8s %5.1f MB: %7.1f MB/s, %6.1f ns/entry, "
+                  "%5zu + %zu rehashes\n",
+                  input.name, input.text.size() / 1e6,
+                  input.text.size() / best / 1e6, best / 100000 * 1e9,
+                  stats.section_rehashes, stats.entry_rehashes);
+    }
+  }
+
+  // Module style initialization: 48 typed values of one section read
+  // one getval at a time versus a single getvals batch.
+  void bench_batch() {
+    const int keys = 48;
+    std::istringstream in(make_config(64, keys));
+    const inipp::inifile cfile(in);
+    const std::string section = "section 17";
+
+    std::vector<std::string> keynames;
+    for(int k = 0; k < keys; ++k) {
+      keynames.push_back("key " + std::to_string(k));
+    }
+
+    std::printf("batch: %d values per section\n", keys);
+
+    scale_threads("getval sections", [&](unsigned) {
+      std::string value;
+      for(const std::string& key : keynames) {
+        value = cfile.getval(section, key, "");
+      }
+      return std::uint64_t(value.size() != 0);
+    });
+
+    std::string unused;
+    std::vector<inipp::field> fields;
+    for(int k = 0; k < keys; ++k) {
+      fields.push_back(inipp::bind(keynames[k], unused));
+    }
+
+    scale_threads("getvals sections", [&](unsigned) {
+      // each thread needs its own targets
+      thread_local std::vector<std::string> mine;
+      thread_local std::vector<inipp::field> myfields;
+      if(myfields.empty()) {
+        mine.resize(keys);
+        myfields = fields;
+        for(int k = 0; k < keys; ++k) {
+          myfields[k].target = &mine[k];
+        }
+      }
+      return std::uint64_t(cfile.getvals(section, myfields.data(),
+                                         myfields.size()) == keys);
+    });
+  }
+
+
+#ifdef INIPP_WITH_ZLIB
+  std::string gzip_compress(const std::string& data) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+
+    std::string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return out;
+  }
+#endif
+
+#ifdef INIPP_WITH_ZSTD
+  std::string zstd_compress(const std::string& data) {
+    std::string out(ZSTD_compressBound(data.size()), '\0');
+    out.resize(ZSTD_compress(&out[0], out.size(), data.data(), data.size(),
+                             3));
+    return out;
+  }
+#endif
+
+  // Parse throughput of plain versus compressed input, in megabytes of
+  // uncompressed text per second.
+  void bench_compressed() {
+    const std::string text = make_config(1000, 1000);
+    const double mb = text.size() / 1e6;
+
+    std::printf("compressed: %.1f MB of config text\n", mb);
+
+    double plain = seconds([&]() {
+      std::istringstream in(text);
+      inipp::inifile cfile(in);
+    });
+    std::printf("  plain:  %8.1f MB/s\n", mb / plain);
+
+#ifdef INIPP_WITH_ZLIB
+    const std::string gz = gzip_compress(text);
+    double gzip = seconds([&]() {
+      std::istringstream raw(gz);
+      inipp::decompressing_istream in(raw);
+      inipp::inifile cfile(in);
+    });
+    std::printf("  gzip:   %8.1f MB/s (%.1f MB compressed)\n",
+                mb / gzip, gz.size() / 1e6);
+#else
+    std::printf("  gzip:   not built with INIPP_WITH_ZLIB\n");
+#endif
+
+#ifdef INIPP_WITH_ZSTD
+    const std::string zst = zstd_compress(text);
+    double zstd = seconds([&]() {
+      std::istringstream raw(zst);
+      inipp::decompressing_istream in(raw);
+      inipp::inifile cfile(in);
+    });
+    std::printf("  zstd:   %8.1f MB/s (%.1f MB compressed)\n",
+                mb / zstd, zst.size() / 1e6);
+#else
+    std::printf("  zstd:   not built with INIPP_WITH_ZSTD\n");
+#endif
+  }
+
+  // Memory resource counting the bytes currently allocated through it.
+  class counting_resource : public std::pmr::memory_resource
+  {
+    public:
+      std::size_t bytes = 0;
+
+    protected:
+      void* do_allocate(std::size_t size, std::size_t align) override {
+        bytes += size;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+      }
+
+      void do_deallocate(void* p, std::size_t size,
+                         std::size_t align) override {
+        bytes -= size;
+        std::pmr::new_delete_resource()->deallocate(p, size, align);
+      }
+
+      bool do_is_equal(const std::pmr::memory_resource& other)
+        const noexcept override {
+        return this == &other;
+      }
+  };
+
+  // Bytes held per entry by a loaded inifile, for typical short values
+  // and for values longer than the inline limit.
+  void bench_memory() {
+    std::printf("memory: bytes per entry, excluding allocator overhead\n");
+
+    for(const char* padding : { "", "-and-some-more-text" }) {
+      std::string text;
+      const int sections = 100;
+      const int keys = 100;
+
+      for(int s = 0; s < sections; ++s) {
+        text += "[section " + std::to_string(s) + "]\n";
+        for(int k = 0; k < keys; ++k) {
+          text += "key " + std::to_string(k) + " = value " +
+                  std::to_string(s * keys + k) + padding + "\n";
+        }
+      }
+
+      counting_resource counter;
+      std::istringstream in(text);
+      inipp::inifile cfile(in, inipp::parse_options(), &counter);
+
+      std::printf("  %-6s values: %6.1f bytes/entry\n",
+                  *padding ? "long" : "short",
+                  double(counter.bytes) / (sections * keys));
+    }
+  }
+
+  struct benchmark
+  {
+    const char* name;
+    std::function<void()> run;
+  };
+}
+
+int main(int argc, char** argv) {
+  const benchmark benchmarks[] = {
+    { "readers", bench_readers },
+    { "snapshot", bench_snapshot },
+    { "batch", bench_batch },
+    { "bulk", bench_bulk },
+    { "memory", bench_memory },
+    { "typed", bench_typed },
+    { "parse", bench_parse },
+    { "compressed", bench_compressed },
+  };
+
+  for(const benchmark& b : benchmarks) {
+    bool selected = (argc < 2);
+
+    for(int i = 1; i < argc; ++i) {
+      selected = selected || !std::strcmp(argv[i], b.name);
+    }
+
+    if(selected) {
+      b.run();
+    }
+  }
+
+  return 0;
+}
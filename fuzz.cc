@@ -0,0 +1,547 @@
+// Copyright (c) 2009, Florian Wagner <florian@wagner-flo.net>.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright
+// notice, this list of conditions and the following disclaimer in the
+// documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Fuzz target for inipp. Every input is parsed by inipp::inifile,
+// inipp::parse and inipp::inidocument and compared against a deliberately
+// naive reference implementation of the rules in README.rst, through all
+// lookup methods, origin() and inidocument edits, so faster rewrites can
+// be checked for equivalence. Any mismatch aborts.
+//
+// libFuzzer:  make fuzz && ./fuzz fuzz-corpus
+// AFL++:      make fuzz-replay CXX=afl-clang-fast++
+//             afl-fuzz -i fuzz-corpus -o findings ./fuzz-replay @@
+// Replay:     make check-fuzz
+
+#include <inipp.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+namespace
+{
+  struct model
+  {
+    bool error = false;
+    std::map<std::string, std::string> defaults;
+    std::map<std::string, std::map<std::string, std::string>> sections;
+
+    // line (1-based) of the definition that wins, for origin()
+    std::map<std::string, std::size_t> default_lines;
+    std::map<std::string, std::map<std::string, std::size_t>> section_lines;
+  };
+
+  bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == '\f' || c == '\v';
+  }
+
+  std::string strip(const std::string& s) {
+    std::size_t b = 0;
+    std::size_t e = s.size();
+
+    while(b < e && is_space(s[b])) {
+      ++b;
+    }
+    while(e > b && is_space(s[e - 1])) {
+      --e;
+    }
+
+    return s.substr(b, e - b);
+  }
+
+  // README rules, one line at a time, without any cleverness
+  model reference(const std::string& text) {
+    model m;
+    std::map<std::string, std::string>* current = &m.defaults;
+    std::map<std::string, std::size_t>* lines = &m.default_lines;
+    std::size_t pos = (text.compare(0, 3, "\xEF\xBB\xBF") == 0) ? 3 : 0;
+    std::size_t lineno = 0;
+
+    while(pos < text.size()) {
+      ++lineno;
+      std::size_t nl = text.find_first_of("\r\n", pos);
+      if(nl == std::string::npos) {
+        nl = text.size();
+      }
+
+      std::string line = strip(text.substr(pos, nl - pos));
+      pos = nl + 1;
+      if(text.compare(nl, 2, "\r\n") == 0) {
+        ++pos;
+      }
+
+      if(!line.empty() && line[0] == '[') {
+        std::size_t close = line.find(']');
+        if(close == std::string::npos) {
+          m.error = true;
+          return m;
+        }
+
+        std::string rest = strip(line.substr(close + 1));
+        if(!rest.empty() && rest[0] != '#' && rest[0] != ';') {
+          m.error = true;
+          return m;
+        }
+
+        const std::string name = strip(line.substr(1, close - 1));
+        current = &m.sections[name];
+        lines = &m.section_lines[name];
+        continue;
+      }
+
+      for(std::size_t i = 0; i < line.size(); ++i) {
+        if(line[i] == '#' || line[i] == ';') {
+          line = strip(line.substr(0, i));
+          break;
+        }
+      }
+
+      if(line.empty()) {
+        continue;
+      }
+
+      std::size_t eq = line.find('=');
+      if(eq == std::string::npos) {
+        m.error = true;
+        return m;
+      }
+
+      const std::string key = strip(line.substr(0, eq));
+      (*current)[key] = strip(line.substr(eq + 1));
+      (*lines)[key] = lineno;
+    }
+
+    return m;
+  }
+
+  // whether text decodes as UTF-8 without the replacement of any byte,
+  // checked naively against the code point ranges
+  bool utf8(const std::string& text) {
+    for(std::size_t i = 0; i < text.size(); ) {
+      const unsigned char c = text[i];
+      std::size_t len = (c < 0x80) ? 1 : (c >> 5) == 6 ? 2
+                      : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 0;
+
+      if(len == 0 || i + len > text.size()) {
+        return false;
+      }
+
+      std::uint32_t cp = (len == 1) ? c : c & (0x7f >> len);
+      for(std::size_t k = 1; k < len; ++k) {
+        const unsigned char d = text[i + k];
+        if((d & 0xc0) != 0x80) {
+          return false;
+        }
+        cp = (cp << 6) | (d & 0x3f);
+      }
+
+      const std::uint32_t min[] = { 0, 0, 0x80, 0x800, 0x10000 };
+      if(cp < min[len] || cp > 0x10ffff || (cp >= 0xd800 && cp < 0xe000)) {
+        return false;
+      }
+      i += len;
+    }
+
+    return true;
+  }
+
+  void check(bool ok, const char* what) {
+    if(!ok) {
+      std::fprintf(stderr, "mismatch: %s\n", what);
+      std::abort();
+    }
+  }
+
+  // Exercises every lookup method against the expected values.
+  void check_lookups(const inipp::inifile& cfile, const model& m) {
+    for(const auto& kv : m.defaults) {
+      check(cfile.get(kv.first) == kv.second, "get(key)");
+      check(cfile.dget(kv.first, "?") == kv.second, "dget(key)");
+    }
+
+    for(const auto& sec : m.sections) {
+      inipp::inisection section = cfile.section(sec.first);
+      check(section.name() == sec.first, "section().name()");
+
+      for(const auto& kv : sec.second) {
+        check(cfile.get(sec.first, kv.first) == kv.second, "get");
+        check(cfile.dget(sec.first, kv.first, "?") == kv.second, "dget");
+        check(cfile.getval(sec.first, kv.first, "") == kv.second, "getval");
+        check(section.get(kv.first) == kv.second, "section().get");
+        check(section.dget(kv.first, "?") == kv.second, "section().dget");
+        (void) cfile.getval(sec.first, kv.first, 0L);
+        (void) cfile.getval(sec.first, kv.first, 0.0);
+        (void) cfile.getval(sec.first, kv.first, false);
+        (void) section.getval(kv.first, 0u);
+      }
+
+      try {
+        cfile.get(sec.first, "\n");
+        check(false, "get of impossible key");
+      }
+      catch(inipp::unknown_entry_error&) { /* expected */ }
+
+      // batches in reverse order, with a missing key in the middle
+      std::vector<std::string_view> keys;
+      std::vector<std::string> values(sec.second.size() + 1, "?");
+      std::vector<inipp::field> fields;
+
+      for(auto it = sec.second.rbegin(); it != sec.second.rend(); ++it) {
+        keys.push_back(it->first);
+        if(keys.size() == sec.second.size() / 2 + 1) {
+          keys.push_back("\n");
+        }
+      }
+      if(keys.size() == sec.second.size()) {
+        keys.push_back("\n");
+      }
+      for(std::size_t i = 0; i < keys.size(); ++i) {
+        fields.push_back(inipp::bind(keys[i], values[i]));
+      }
+
+      const auto found = cfile.lookup(sec.first, keys);
+      check(found.size() == keys.size(), "lookup size");
+      check(cfile.getvals(sec.first, fields.data(), fields.size()) ==
+            sec.second.size(), "getvals count");
+
+      for(std::size_t i = 0; i < keys.size(); ++i) {
+        auto want = sec.second.find(std::string(keys[i]));
+
+        if(want == sec.second.end()) {
+          check(!found[i], "lookup of missing key");
+          check(!fields[i].found && values[i] == "?", "getvals missing key");
+        }
+        else {
+          check(found[i] && *found[i] == want->second, "lookup");
+          check(fields[i].found && values[i] == want->second, "getvals");
+        }
+      }
+    }
+
+    // one bulk lookup across all sections, interleaved with misses
+    std::vector<inipp::key_ref> refs;
+    std::vector<const std::string*> want;
+    std::vector<std::string> missing;
+
+    missing.reserve(m.sections.size());
+
+    for(const auto& kv : m.defaults) {
+      refs.push_back({ std::string_view(), kv.first, true });
+      want.push_back(&kv.second);
+    }
+    for(const auto& sec : m.sections) {
+      for(const auto& kv : sec.second) {
+        refs.push_back({ sec.first, kv.first, false });
+        want.push_back(&kv.second);
+        refs.push_back({ sec.first, "\n", false });
+        want.push_back(nullptr);
+      }
+      missing.push_back(sec.first + "\n");
+      refs.push_back({ missing.back(), "", false });
+      want.push_back(nullptr);
+    }
+    std::reverse(refs.begin() + refs.size() / 2, refs.end());
+    std::reverse(want.begin() + want.size() / 2, want.end());
+
+    const auto bulk = cfile.lookup(refs);
+    check(bulk.size() == refs.size(), "bulk lookup size");
+    for(std::size_t i = 0; i < refs.size(); ++i) {
+      check(want[i] ? bulk[i] && *bulk[i] == *want[i] : !bulk[i],
+            "bulk lookup");
+    }
+  }
+
+  // Every entry reports the file layer and the line that set it last;
+  // untracked configurations report the unknown layer.
+  void check_origins(const inipp::inifile& cfile, const model& m,
+                     std::uint32_t file_id) {
+    auto same = [&](const inipp::provenance& from, std::size_t line) {
+      return file_id ? from.layer == inipp::provenance::file &&
+                       from.file_id == file_id && from.line == line
+                     : from.layer == inipp::provenance::unknown &&
+                       from.file_id == 0 && from.line == 0;
+    };
+
+    for(const auto& kv : m.default_lines) {
+      check(same(cfile.origin(kv.first), kv.second), "origin(key)");
+    }
+    for(const auto& sec : m.section_lines) {
+      for(const auto& kv : sec.second) {
+        check(same(cfile.origin(sec.first, kv.first), kv.second), "origin");
+      }
+
+      try {
+        cfile.origin(sec.first, "\n");
+        check(false, "origin of impossible key");
+      }
+      catch(inipp::unknown_entry_error&) { /* expected */ }
+    }
+  }
+
+  // Values classified while loading convert exactly like the text.
+  void check_typed(const inipp::inifile& cfile, const inipp::inifile& typed,
+                   const model& m) {
+    for(const auto& sec : m.sections) {
+      for(const auto& kv : sec.second) {
+        const std::string& s = sec.first;
+        const std::string& k = kv.first;
+        const double a = cfile.getval(s, k, 0.5);
+        const double b = typed.getval(s, k, 0.5);
+
+        check(cfile.getval(s, k, 1L) == typed.getval(s, k, 1L),
+              "typed getval<long>");
+        check(cfile.getval(s, k, 1u) == typed.getval(s, k, 1u),
+              "typed getval<unsigned>");
+        check(cfile.getval(s, k, true) == typed.getval(s, k, true),
+              "typed getval<bool>");
+        check(std::memcmp(&a, &b, sizeof(a)) == 0, "typed getval<double>");
+        check(cfile.getval(s, k, std::chrono::nanoseconds(1)) ==
+              typed.getval(s, k, std::chrono::nanoseconds(1)),
+              "typed getval<duration>");
+        check(cfile.getsize(s, k, 1) == typed.getsize(s, k, 1),
+              "typed getsize");
+      }
+    }
+  }
+
+  // The expected configuration built through the modification API.
+  inipp::inifile build(const model& m) {
+    inipp::inifile cfile;
+
+    for(const auto& kv : m.defaults) {
+      cfile.set(kv.first, kv.second);
+    }
+    for(const auto& sec : m.sections) {
+      // creates the section even if it stays empty
+      cfile.set(sec.first, "\n", "");
+      cfile.erase(sec.first, "\n");
+
+      for(const auto& kv : sec.second) {
+        cfile.set(sec.first, kv.first, kv.second);
+      }
+    }
+
+    return cfile;
+  }
+
+  // Edits a document through set and erase, in every section: changes
+  // one value, erases another key and adds a new one, then adds a
+  // section. Its text must reparse to the model edited the same way.
+  void check_edits(const std::string& text, model m) {
+    inipp::inidocument doc(text);
+    int n = 0;
+
+    auto edit = [&](const std::string* section,
+                    std::map<std::string, std::string>& entries) {
+      if(!entries.empty()) {
+        const std::string key = entries.begin()->first;
+        const std::string value = "edited " + std::to_string(++n);
+        section ? doc.set(*section, key, value) : doc.set(key, value);
+        entries[key] = value;
+      }
+      if(entries.size() > 1) {
+        const std::string key = entries.rbegin()->first;
+        check(section ? doc.erase(*section, key) : doc.erase(key),
+              "inidocument erase");
+        entries.erase(key);
+      }
+      check(!(section ? doc.erase(*section, "\n") : doc.erase("\n")),
+            "inidocument erase of impossible key");
+
+      const std::string value = "added " + std::to_string(++n);
+      section ? doc.set(*section, "fuzz added", value)
+              : doc.set("fuzz added", value);
+      entries["fuzz added"] = value;
+    };
+
+    edit(nullptr, m.defaults);
+    for(auto& sec : m.sections) {
+      edit(&sec.first, sec.second);
+    }
+    doc.set("fuzz new section", "k", "v");
+    m.sections["fuzz new section"]["k"] = "v";
+
+    for(const auto& kv : m.defaults) {
+      check(doc.get(kv.first) == kv.second, "edited get(key)");
+    }
+    for(const auto& sec : m.sections) {
+      for(const auto& kv : sec.second) {
+        check(doc.get(sec.first, kv.first) == kv.second, "edited get");
+      }
+    }
+
+    std::istringstream in(doc.str());
+    const inipp::inifile reparsed(in);
+    check(inipp::diff(build(m), reparsed).empty(), "inidocument edits");
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data,
+                                      std::size_t size) {
+  const std::string text(reinterpret_cast<const char*>(data), size);
+  const model expected = reference(text);
+
+  inipp::parse_options options;
+  options.max_line_length = size + 1;
+
+  // inifile
+  std::istringstream in(text);
+  try {
+    const inipp::inifile cfile(in, options);
+    check(!expected.error, "inifile accepted invalid input");
+
+    const inipp::inifile want = build(expected);
+    check(inipp::diff(want, cfile).empty(), "diff against reference");
+    check(want.fingerprint() == cfile.fingerprint(), "fingerprint");
+    check_lookups(cfile, expected);
+
+    // read-only image
+    std::vector<std::uint64_t> image((cfile.image_size() + 7) / 8);
+    cfile.write_image(image.data());
+    const inipp::inifile attached =
+      inipp::inifile::attach(image.data(), cfile.image_size());
+    check(inipp::diff(want, attached).empty(), "diff against image");
+    check(want.fingerprint() == attached.fingerprint(), "image fingerprint");
+    check_lookups(attached, expected);
+
+    // provenance, tracked while loading or not at all
+    inipp::parse_options ooptions = options;
+    ooptions.track_origins = true;
+    ooptions.file_id = 7;
+    std::istringstream oin(text);
+    const inipp::inifile tracked(oin, ooptions);
+    check(inipp::diff(cfile, tracked).empty(), "tracked contents");
+    check_origins(tracked, expected, ooptions.file_id);
+    check_origins(cfile, expected, 0);
+    check_origins(attached, expected, 0);
+
+    // typed values
+    inipp::parse_options toptions = options;
+    toptions.typed_values = true;
+    std::istringstream tin(text);
+    const inipp::inifile typed(tin, toptions);
+    check_typed(cfile, typed, expected);
+
+    // UTF-8 validation either rejects the input or changes nothing
+    inipp::parse_options uoptions = options;
+    uoptions.validate_utf8 = true;
+    std::istringstream uin(text);
+    try {
+      const inipp::inifile validated(uin, uoptions);
+      check(utf8(text), "accepted invalid UTF-8");
+      check(inipp::diff(cfile, validated).empty(), "validated UTF-8");
+    }
+    catch(inipp::syntax_error&) {
+      check(!utf8(text), "rejected valid UTF-8");
+    }
+  }
+  catch(inipp::syntax_error&) {
+    check(expected.error, "inifile rejected valid input");
+  }
+
+  // streaming parser with a small buffer
+  options.buffer_size = 7;
+  std::istringstream sin(text);
+  std::size_t entries = 0;
+  std::size_t want_entries = expected.defaults.size();
+
+  for(const auto& sec : expected.sections) {
+    want_entries += sec.second.size();
+  }
+
+  try {
+    inipp::parse(sin, [&](const inipp::parse_event& ev) {
+      entries += (ev.kind == inipp::parse_event::entry);
+    }, options);
+    check(!expected.error, "parse accepted invalid input");
+    // duplicates are reported by every occurrence
+    check(entries >= want_entries, "parse entry count");
+  }
+  catch(inipp::syntax_error&) {
+    check(expected.error, "parse rejected valid input");
+  }
+
+  // lossless document
+  try {
+    inipp::inidocument doc(text);
+    check(!expected.error, "inidocument accepted invalid input");
+    check(doc.str() == text, "inidocument round trip");
+
+    for(const auto& kv : expected.defaults) {
+      check(doc.get(kv.first) == kv.second, "inidocument get(key)");
+    }
+    for(const auto& sec : expected.sections) {
+      for(const auto& kv : sec.second) {
+        check(doc.get(sec.first, kv.first) == kv.second, "inidocument get");
+      }
+    }
+
+    check_edits(text, expected);
+
+    // erasing what set() added restores the text
+    if(!expected.sections.count("fuzz new section")) {
+      inipp::inidocument undo(text);
+      undo.set("fuzz new section", "k", "v");
+      check(undo.erase("fuzz new section", "k"), "inidocument erase added");
+      check(undo.str() == text, "inidocument set and erase");
+    }
+  }
+  catch(inipp::syntax_error&) {
+    check(expected.error, "inidocument rejected valid input");
+  }
+
+  return 0;
+}
+
+#ifdef INIPP_FUZZ_STANDALONE
+// Driver for AFL++ and corpus replay: runs every file named on the
+// command line, or standard input without arguments.
+int main(int argc, char** argv) {
+  auto run = [](std::istream& in) {
+    std::string data((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(
+      reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+  };
+
+  if(argc < 2) {
+    run(std::cin);
+  }
+
+  for(int i = 1; i < argc; ++i) {
+    std::ifstream in(argv[i], std::ios::binary);
+    run(in);
+  }
+
+  return 0;
+}
+#endif
@@ -32,15 +32,90 @@
 #define INIPP_VERSION "1.0"
 
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <cstdint>
+#include <vector>
 #include <fstream>
 #include <stdexcept>
 #include <sstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <limits>
+#include <type_traits>
+#include <charconv>
+#include <chrono>
+
+// Optional decompression support, see inipp::decompressing_istream.
+#ifdef INIPP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef INIPP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// Optional POSIX shared memory support, see inipp::shm_publish.
+#ifdef INIPP_WITH_SHM
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// environment of the process, for inifile::apply_environment
+#if !defined(_WIN32)
+extern "C" char** environ;
+#endif
 
 namespace inipp
 {
   class inifile;
   class inisection;
+  class inidocument;
+
+  // 128-bit content fingerprint. Fingerprints of unordered collections
+  // are combined with += and -=, which makes them independent of order
+  // and cheap to update one element at a time.
+  struct digest
+  {
+    std::uint64_t lo;
+    std::uint64_t hi;
+
+    inline digest& operator+=(const digest& other);
+    inline digest& operator-=(const digest& other);
+    inline bool operator==(const digest& other) const;
+    inline bool operator!=(const digest& other) const;
+
+    // 32 lowercase hex digits
+    inline std::string str() const;
+  };
+
+  // One difference between two inifile objects as reported by diff().
+  struct change
+  {
+    enum kind_t { added, removed, changed };
+
+    kind_t kind;
+    bool default_section;
+    std::string section;
+    std::string key;
+    std::string old_value;
+    std::string new_value;
+  };
+
+  inline std::vector<change> diff(const inifile& from, const inifile& to);
 
   class unknown_entry_error : public std::runtime_error
   {
@@ -72,6 +147,136 @@ namespace inipp
       { /* empty */ };
   };
 
+  // Limits for reading input. Lines are unlimited by default, the read
+  // buffer grows to hold the longest line. With max_line_length set it
+  // is enlarged up front to hold one line of that length instead, so
+  // memory use is bounded by the larger of the two plus the current
+  // section name, regardless of the input size.
+  struct parse_options
+  {
+    std::size_t buffer_size = 1 << 16;
+    std::size_t max_line_length = 0;  // 0: unlimited
+
+    // Classify every value of an inifile while loading and keep
+    // integers, floating point numbers and booleans in binary next to
+    // the text, so getval() for bool, integer types and double need not
+    // parse it again. Costs 16 bytes per entry.
+    bool typed_values = false;
+
+    // Record the provenance of every entry of an inifile, see
+    // inifile::origin(); file_id is reported as its file. Costs 12
+    // bytes per entry.
+    bool track_origins = false;
+    std::uint32_t file_id = 0;
+
+    // Reject input that is not well-formed UTF-8 (no overlong forms,
+    // surrogates or code points above U+10FFFF) with a syntax_error
+    // naming the line and the byte offset within it.
+    bool validate_utf8 = false;
+
+    // Size hints for loading an inifile. Its section map and the entry
+    // tables of its sections are sized up front, so they are not
+    // rehashed while growing: for as many sections and, per section,
+    // as many entries as size_hint (e.g. the previous version of the
+    // same file) has, and otherwise for expected_sections sections and
+    // expected_entries entries in each section.
+    const inifile* size_hint = nullptr;
+    std::size_t expected_sections = 0;
+    std::size_t expected_entries = 0;
+  };
+
+  // Shape of a loaded inifile and the rehashes it took to build it, see
+  // inifile::stats().
+  struct load_stats
+  {
+    std::size_t sections = 0;          // excluding the default section
+    std::size_t entries = 0;           // distinct keys of all sections
+    std::size_t largest_section = 0;   // entries of the largest section
+    std::size_t section_rehashes = 0;  // of the section map
+    std::size_t entry_rehashes = 0;    // of the entry tables
+  };
+
+  // A section header or entry as reported by inipp::parse(). The views
+  // are only valid during the callback.
+  struct parse_event
+  {
+    enum kind_t { header, entry };
+
+    kind_t kind;
+    bool default_section;
+    std::string_view section;
+    std::string_view key;
+    std::string_view value;
+    std::size_t line;
+  };
+
+  // Streaming parser: reads the stream block by block through a fixed
+  // size buffer and calls handler(const parse_event&) for every section
+  // header and entry. Lines longer than options.max_line_length (if
+  // set) and invalid lines throw a syntax_error. On invalid lines seekable
+  // streams are left just behind the offending line.
+  template<typename Handler>
+  inline void parse(std::istream& in, Handler&& handler,
+                    const parse_options& options = parse_options(),
+                    std::pmr::memory_resource* resource =
+                      std::pmr::get_default_resource());
+
+  // One key of a batched, typed lookup, see inifile::getvals().
+  struct field
+  {
+    std::string_view key;
+    void* target;
+    bool (*convert)(std::string_view value, void* target);
+    bool found;  // set by getvals()
+  };
+
+  // Field converting the value of key to T as getval() does. target
+  // holds the default: it is left unchanged if the key is missing or its
+  // value does not convert.
+  template<typename T>
+  inline field bind(std::string_view key, T& target);
+  template<typename T, typename D>
+  inline field bind(std::string_view key, T& target, D&& def);
+
+  // Where the value of an entry came from, see inifile::origin(). For
+  // the file layer file_id is parse_options::file_id and line the line
+  // number (1-based), for the command_line layer line is the position
+  // in the batch; both are zero otherwise.
+  struct provenance
+  {
+    enum layer_t : std::uint8_t { unknown, file, environment, command_line,
+                                  runtime };
+
+    layer_t layer = unknown;
+    std::uint32_t file_id = 0;
+    std::uint32_t line = 0;
+  };
+
+  // Mapping of environment variables onto entries, see
+  // inifile::apply_environment(). By default PREFIX__SECTION__KEY sets
+  // key in section and PREFIX__KEY a key of the default section, with
+  // names converted to lower case. map, if set, replaces this mapping:
+  // it receives the variable name after the prefix and separator and
+  // returns false to skip the variable. An empty prefix would import
+  // the whole environment (PATH, HOME, credentials, ...), so it is
+  // only accepted together with a map that picks the variables.
+  struct env_overlay
+  {
+    std::string prefix;
+    std::string separator = "__";
+    bool lowercase = true;
+    std::function<bool(std::string_view name, std::string& section,
+                       std::string& key, bool& default_section)> map;
+  };
+
+  // A (section, key) pair of a bulk lookup, see inifile::lookup().
+  struct key_ref
+  {
+    std::string_view section;
+    std::string_view key;
+    bool default_section = false;
+  };
+
   class inisection
   {
     friend class inifile;
@@ -84,22 +289,10 @@ namespace inipp
 
       template<typename T>
       T getval( const std::string& key
-	      , const T def) const
-      {
-	  std::string src;
-	  try {
-		  src = get(key);
-	  } catch (...) {
-		  return def;
-	  }
+	      , const T def) const;
 
-	  std::istringstream i{src};
-	  char c;
-	  T rv;
-	  if ((i>>std::boolalpha>>rv) && !(i>>c))
-		  return rv;
-	  return def;
-      }
+      inline std::uint64_t getsize(const std::string& key,
+                                   std::uint64_t def) const;
 
       const std::string getval( const std::string& key
 			      , const char* def) const
@@ -121,11 +314,585 @@ namespace inipp
       const inifile& _ini;
   };
 
+  namespace private_
+  {
+    // Hash and equality accepting anything convertible to string_view,
+    // so (with C++20) lookups need no temporary key strings.
+    struct string_hash
+    {
+      typedef void is_transparent;
+
+      std::size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+      }
+    };
+
+    struct string_equal
+    {
+      typedef void is_transparent;
+
+      bool operator()(std::string_view a, std::string_view b) const {
+        return a == b;
+      }
+    };
+
+    template<typename Map>
+    inline auto find(Map& map, std::string_view key) -> decltype(map.end());
+
+    inline void prefetch(const void* p);
+
+    // Binary form of a value classified while loading; see
+    // parse_options::typed_values.
+    struct typed_value
+    {
+      enum tag_t : std::uint8_t { none, integer, floating, boolean,
+                                  duration, size };
+
+      tag_t tag;
+      union
+      {
+        std::int64_t i;   // integer, duration in nanoseconds
+        std::uint64_t u;  // size in bytes
+        double d;
+        bool b;
+      };
+
+      // types getval() reads from here; characters are read one at a
+      // time by streams and other floating point types round differently
+      template<typename T>
+      static constexpr bool supported() {
+        return std::is_same<T, double>::value ||
+               (std::is_integral<T>::value &&
+                !std::is_same<T, char>::value &&
+                !std::is_same<T, signed char>::value &&
+                !std::is_same<T, unsigned char>::value &&
+                !std::is_same<T, wchar_t>::value &&
+                !std::is_same<T, char16_t>::value &&
+                !std::is_same<T, char32_t>::value);
+      }
+
+      // Stores the value in out if it reads back exactly as getval()
+      // would parse the text; otherwise the text must be parsed.
+      template<typename T>
+      bool get(T& out) const {
+        if constexpr(std::is_same<T, bool>::value) {
+          if(this->tag != boolean) {
+            return false;
+          }
+          out = this->b;
+        }
+        else if constexpr(std::is_integral<T>::value) {
+          if(this->tag != integer) {
+            return false;
+          }
+          if constexpr(std::is_signed<T>::value) {
+            if(this->i < std::int64_t(std::numeric_limits<T>::min()) ||
+               this->i > std::int64_t(std::numeric_limits<T>::max())) {
+              return false;
+            }
+          }
+          else if(this->i < 0 || std::uint64_t(this->i) >
+                                 std::numeric_limits<T>::max()) {
+            return false;
+          }
+          out = static_cast<T>(this->i);
+        }
+        else {
+          if(this->tag == integer) {
+            out = static_cast<double>(this->i);
+          }
+          else if(this->tag == floating) {
+            out = this->d;
+          }
+          else {
+            return false;
+          }
+        }
+        return true;
+      }
+    };
+
+    inline typed_value classify(std::string_view s);
+
+    // Hand-rolled parsers for getval() of durations and getsize().
+    inline bool parse_duration(std::string_view s, std::int64_t& ns);
+    inline bool parse_size(std::string_view s, std::uint64_t& bytes);
+
+    // Prefetches the first node in the bucket of hash, assuming modulo
+    // bucket selection; a wrong guess only wastes the prefetch.
+    template<typename Map>
+    inline void prefetch_bucket(const Map& map, std::size_t hash);
+
+    // find() for batches of lookups: without heterogeneous lookup, one
+    // scratch key on the stack is reused instead of building a new one
+    // per key.
+    class batch_finder
+    {
+      public:
+        batch_finder()
+#if !defined(__cpp_lib_generic_unordered_lookup)
+          : scratch_(buf_, sizeof(buf_)), key_(&scratch_)
+#endif
+        { /* empty */ }
+
+        template<typename Map>
+        auto find(Map& map, std::string_view key) -> decltype(map.end()) {
+#if defined(__cpp_lib_generic_unordered_lookup)
+          return map.find(key);
+#else
+          this->key_.assign(key);
+          return map.find(this->key_);
+#endif
+        }
+
+#if !defined(__cpp_lib_generic_unordered_lookup)
+      protected:
+        char buf_[256];
+        std::pmr::monotonic_buffer_resource scratch_;
+        std::pmr::string key_;
+#endif
+    };
+
+    // Entries of one section: kept densely in a vector (erase moves the
+    // last entry into the gap) and found through an open addressing
+    // index of entry numbers with linear probing. Keys and values of up
+    // to 15 bytes are stored inline, longer ones in a string pool of the
+    // table addressed by 32-bit offsets. Views of keys and values are
+    // invalidated by any modification of the table.
+    class entry_table
+    {
+      public:
+        typedef std::pmr::polymorphic_allocator<char> allocator_type;
+
+        static const std::size_t npos = std::size_t(-1);
+
+        explicit entry_table(const allocator_type& alloc = allocator_type())
+          : entries_(alloc), index_(alloc), pool_(alloc), typed_(alloc),
+            origins_(alloc), garbage_(0), typed_on_(false), origins_on_(false)
+        { /* empty */ }
+
+        // user-declared copies would otherwise turn moves into copies
+        // onto the default resource
+        entry_table(const entry_table& other) = default;
+        entry_table(entry_table&& other) noexcept = default;
+        entry_table& operator=(const entry_table& other) = default;
+        entry_table& operator=(entry_table&& other) = default;
+
+        entry_table(const entry_table& other, const allocator_type& alloc)
+          : entries_(other.entries_, alloc), index_(other.index_, alloc),
+            pool_(other.pool_, alloc), typed_(other.typed_, alloc),
+            origins_(other.origins_, alloc), garbage_(other.garbage_),
+            typed_on_(other.typed_on_), origins_on_(other.origins_on_)
+        { /* empty */ }
+
+        entry_table(entry_table&& other, const allocator_type& alloc)
+          : entries_(std::move(other.entries_), alloc),
+            index_(std::move(other.index_), alloc),
+            pool_(std::move(other.pool_), alloc),
+            typed_(std::move(other.typed_), alloc),
+            origins_(std::move(other.origins_), alloc),
+            garbage_(other.garbage_), typed_on_(other.typed_on_),
+            origins_on_(other.origins_on_)
+        { /* empty */ }
+
+        static std::uint32_t hash(std::string_view key) {
+          const std::uint64_t h = std::hash<std::string_view>()(key);
+          return static_cast<std::uint32_t>(h ^ (h >> 32));
+        }
+
+        std::size_t size() const {
+          return this->entries_.size();
+        }
+
+        std::string_view key(std::size_t i) const {
+          return this->str(this->entries_[i].key);
+        }
+
+        std::string_view value(std::size_t i) const {
+          return this->str(this->entries_[i].value);
+        }
+
+        // Keeps a classified copy of every value from now on.
+        void enable_typed() {
+          if(!this->typed_on_) {
+            this->typed_on_ = true;
+            this->typed_.reserve(this->entries_.size());
+            for(std::size_t i = 0; i < this->entries_.size(); ++i) {
+              this->typed_.push_back(classify(this->value(i)));
+            }
+          }
+        }
+
+        // nullptr unless enabled
+        const typed_value* typed(std::size_t i) const {
+          return this->typed_on_ ? &this->typed_[i] : nullptr;
+        }
+
+        // Records a provenance for every entry from now on; entries
+        // already present get an unknown one.
+        void enable_origins() {
+          if(!this->origins_on_) {
+            this->origins_on_ = true;
+            this->origins_.resize(this->entries_.size());
+          }
+        }
+
+        provenance origin(std::size_t i) const {
+          return this->origins_on_ ? this->origins_[i] : provenance();
+        }
+
+        void set_origin(std::size_t i, const provenance& from) {
+          if(this->origins_on_) {
+            this->origins_[i] = from;
+          }
+        }
+
+        std::size_t find(std::string_view key) const {
+          return this->find(key, hash(key));
+        }
+
+        std::size_t find(std::string_view key, std::uint32_t h) const {
+          if(this->index_.empty()) {
+            return npos;
+          }
+
+          const std::size_t mask = this->index_.size() - 1;
+          for(std::size_t slot = h & mask; this->index_[slot];
+              slot = (slot + 1) & mask) {
+            const entry_t& e = this->entries_[this->index_[slot] - 1];
+            if(e.hash == h && this->str(e.key) == key) {
+              return this->index_[slot] - 1;
+            }
+          }
+
+          return npos;
+        }
+
+        // index slot of h, for probing batches in table order
+        std::size_t slot(std::uint32_t h) const {
+          return this->index_.empty() ? 0 : h & (this->index_.size() - 1);
+        }
+
+        void prefetch(std::uint32_t h) const {
+          if(!this->index_.empty()) {
+            private_::prefetch(&this->index_[this->slot(h)]);
+          }
+        }
+
+        // Adds an entry; the key must not be present yet.
+        void insert(std::string_view key, std::string_view value) {
+          if(this->entries_.size() >= UINT32_MAX - 1) {
+            throw std::length_error("Too many entries in one section.");
+          }
+          this->reserve(this->entries_.size() + 1);
+
+          entry_t e;
+          e.key = this->store(key);
+          e.value = this->store(value);
+          e.hash = hash(key);
+          if(this->typed_on_) {
+            this->typed_.push_back(classify(value));
+          }
+          if(this->origins_on_) {
+            this->origins_.emplace_back();
+          }
+          this->entries_.push_back(e);
+          this->place(this->entries_.size() - 1);
+        }
+
+        void assign(std::size_t i, std::string_view value) {
+          if(this->typed_on_) {
+            this->typed_[i] = classify(value);
+          }
+          this->release(this->entries_[i].value);
+          this->entries_[i].value = this->store(value);
+          this->collect();
+        }
+
+        void erase(std::size_t i) {
+          const std::size_t last = this->entries_.size() - 1;
+
+          this->unplace(i);
+          this->release(this->entries_[i].key);
+          this->release(this->entries_[i].value);
+
+          if(i != last) {
+            this->index_[this->find_slot(last)] = i + 1;
+            this->entries_[i] = this->entries_[last];
+          }
+
+          if(this->typed_on_) {
+            this->typed_[i] = this->typed_[last];
+            this->typed_.pop_back();
+          }
+          if(this->origins_on_) {
+            this->origins_[i] = this->origins_[last];
+            this->origins_.pop_back();
+          }
+          this->entries_.pop_back();
+          this->collect();
+        }
+
+        // Sizes the index for n entries, keeping it at most 3/4 full.
+        void reserve(std::size_t n) {
+          if(n == 0) {
+            return;
+          }
+
+          std::size_t slots = std::max<std::size_t>(this->index_.size(), 4);
+
+          while(4 * n > 3 * slots) {
+            slots *= 2;
+          }
+
+          if(slots != this->index_.size()) {
+            this->entries_.reserve(n);
+            this->index_.assign(slots, 0);
+            for(std::size_t i = 0; i < this->entries_.size(); ++i) {
+              this->place(i);
+            }
+          }
+        }
+
+        // drops the growth slack of the entries and the pool
+        void shrink_to_fit() {
+          this->entries_.shrink_to_fit();
+          this->pool_.shrink_to_fit();
+          this->typed_.shrink_to_fit();
+          this->origins_.shrink_to_fit();
+        }
+
+        // slots of the hash index, zero until the first entry
+        std::size_t buckets() const {
+          return this->index_.size();
+        }
+
+        // bytes held, including unused capacity
+        std::size_t memory() const {
+          return this->entries_.capacity() * sizeof(entry_t) +
+                 this->index_.capacity() * sizeof(std::uint32_t) +
+                 this->pool_.capacity() +
+                 this->typed_.capacity() * sizeof(typed_value) +
+                 this->origins_.capacity() * sizeof(provenance);
+        }
+
+      protected:
+        // inline strings keep 15 - size in the last byte, pooled strings
+        // 0xff and their offset and size in the first eight
+        struct string_ref
+        {
+          char bytes[16];
+        };
+
+        struct entry_t
+        {
+          string_ref key;
+          string_ref value;
+          std::uint32_t hash;
+        };
+
+        std::string_view str(const string_ref& s) const {
+          if(static_cast<unsigned char>(s.bytes[15]) != 0xff) {
+            return std::string_view(s.bytes, 15 - s.bytes[15]);
+          }
+
+          std::uint32_t offset, size;
+          std::memcpy(&offset, s.bytes, 4);
+          std::memcpy(&size, s.bytes + 4, 4);
+          return std::string_view(this->pool_.data() + offset, size);
+        }
+
+        string_ref store(std::string_view s) {
+          string_ref ref;
+
+          if(s.size() <= 15) {
+            std::copy(s.begin(), s.end(), ref.bytes);
+            ref.bytes[15] = static_cast<char>(15 - s.size());
+            return ref;
+          }
+
+          if(s.size() > UINT32_MAX - this->pool_.size()) {
+            throw std::length_error("Section exceeds 4 GiB of text.");
+          }
+
+          const std::uint32_t offset = this->pool_.size();
+          const std::uint32_t size = s.size();
+          this->pool_.insert(this->pool_.end(), s.begin(), s.end());
+          std::memcpy(ref.bytes, &offset, 4);
+          std::memcpy(ref.bytes + 4, &size, 4);
+          ref.bytes[15] = static_cast<char>(0xff);
+          return ref;
+        }
+
+        void release(const string_ref& s) {
+          if(static_cast<unsigned char>(s.bytes[15]) == 0xff) {
+            this->garbage_ += this->str(s).size();
+          }
+        }
+
+        // Compacts the pool once the garbage outweighs both the live
+        // strings and the entries, which keeps the cost amortized.
+        void collect() {
+          if(2 * this->garbage_ <= this->pool_.size() +
+                                   this->entries_.size() * sizeof(entry_t)) {
+            return;
+          }
+
+          std::pmr::vector<char> pool(this->pool_.get_allocator());
+          pool.reserve(this->pool_.size() - this->garbage_);
+          std::swap(pool, this->pool_);
+
+          for(entry_t& e : this->entries_) {
+            for(string_ref* s : { &e.key, &e.value }) {
+              if(static_cast<unsigned char>(s->bytes[15]) == 0xff) {
+                std::uint32_t offset, size;
+                std::memcpy(&offset, s->bytes, 4);
+                std::memcpy(&size, s->bytes + 4, 4);
+                *s = this->store(std::string_view(pool.data() + offset,
+                                                  size));
+              }
+            }
+          }
+
+          this->garbage_ = 0;
+        }
+
+        void place(std::size_t i) {
+          const std::size_t mask = this->index_.size() - 1;
+          std::size_t slot = this->entries_[i].hash & mask;
+
+          while(this->index_[slot]) {
+            slot = (slot + 1) & mask;
+          }
+          this->index_[slot] = i + 1;
+        }
+
+        std::size_t find_slot(std::size_t i) const {
+          const std::size_t mask = this->index_.size() - 1;
+          std::size_t slot = this->entries_[i].hash & mask;
+
+          while(this->index_[slot] != i + 1) {
+            slot = (slot + 1) & mask;
+          }
+          return slot;
+        }
+
+        // backward shift deletion, so the index needs no tombstones
+        void unplace(std::size_t i) {
+          const std::size_t mask = this->index_.size() - 1;
+          std::size_t hole = this->find_slot(i);
+
+          this->index_[hole] = 0;
+          for(std::size_t slot = (hole + 1) & mask; this->index_[slot];
+              slot = (slot + 1) & mask) {
+            const std::size_t home =
+              this->entries_[this->index_[slot] - 1].hash & mask;
+
+            // move back unless home lies cyclically in (hole, slot]
+            if(((slot - home) & mask) >= ((slot - hole) & mask)) {
+              this->index_[hole] = this->index_[slot];
+              this->index_[slot] = 0;
+              hole = slot;
+            }
+          }
+        }
+
+        std::pmr::vector<entry_t> entries_;
+        std::pmr::vector<std::uint32_t> index_;  // entry number + 1, or 0
+        std::pmr::vector<char> pool_;
+        std::pmr::vector<typed_value> typed_;    // parallel to entries_
+        std::pmr::vector<provenance> origins_;   // parallel to entries_
+        std::size_t garbage_;                    // released pool bytes
+        bool typed_on_;
+        bool origins_on_;
+    };
+
+    // conversion functions of inipp::field
+    template<typename T>
+    inline bool convert(std::string_view value, void* target) {
+      std::istringstream i{std::string(value)};
+      char c;
+      T rv;
+      if((i >> std::boolalpha >> rv) && !(i >> c)) {
+        *static_cast<T*>(target) = rv;
+        return true;
+      }
+      return false;
+    }
+
+    template<>
+    inline bool convert<std::string>(std::string_view value, void* target) {
+      static_cast<std::string*>(target)->assign(value);
+      return true;
+    }
+
+    // Layout of a configuration image (see inifile::write_image). All
+    // offsets are 32-bit byte offsets from the start of the image, so an
+    // image is position independent and can be mapped at any address.
+    struct image_header
+    {
+      char magic[8];              // written last, see image_magic
+      std::uint32_t byte_order;   // image_byte_order as written
+      std::uint32_t nsections;    // named sections
+      std::uint64_t size;
+      std::uint64_t fingerprint_lo;
+      std::uint64_t fingerprint_hi;
+      std::uint32_t sections;     // image_section[nsections + 1]
+      std::uint32_t table;        // uint32_t[slots], section index or 0
+      std::uint32_t slots;
+      std::uint32_t reserved;
+    };
+
+    // The default section comes first, named sections follow.
+    struct image_section
+    {
+      std::uint32_t name;
+      std::uint32_t name_size;
+      std::uint32_t entries;      // image_entry[nentries]
+      std::uint32_t nentries;
+      std::uint32_t table;        // uint32_t[slots], entry index + 1 or 0
+      std::uint32_t slots;
+      std::uint64_t hash_lo;
+      std::uint64_t hash_hi;
+    };
+
+    struct image_entry
+    {
+      std::uint32_t key;
+      std::uint32_t key_size;
+      std::uint32_t value;
+      std::uint32_t value_size;
+    };
+
+    static const char image_magic[8] = { 'I', 'N', 'I', 'P', 'P', 'I', 'M',
+                                         '1' };
+    static const std::uint32_t image_byte_order = 0x01020304;
+  }
+
+  // Thread safety: all const methods of inifile and inisection only
+  // read and may be called concurrently from any number of threads on a
+  // shared object. Methods that modify the object (set, erase) must not
+  // run concurrently with any other call on the same object. Keep const
+  // methods free of caches and other hidden mutation; the concurrent
+  // test and benchmark are there to catch such regressions.
   class inifile
   {
+    friend std::vector<change> diff(const inifile& from, const inifile& to);
+
     public:
-      explicit inline inifile(std::ifstream& infile);
-      explicit inline inifile(std::ifstream&& infile);
+      // All strings and map nodes are allocated from resource, e.g. an
+      // arena or a pre-sized region. Copies use the default resource
+      // (as with all pmr containers), moves keep theirs.
+      explicit inline inifile(std::pmr::memory_resource* resource =
+                                std::pmr::get_default_resource());
+      explicit inline inifile(std::istream& infile,
+                              const parse_options& options = parse_options(),
+                              std::pmr::memory_resource* resource =
+                                std::pmr::get_default_resource());
+      explicit inline inifile(std::ifstream&& infile,
+                              const parse_options& options = parse_options(),
+                              std::pmr::memory_resource* resource =
+                                std::pmr::get_default_resource());
 
       inline std::string get(const std::string& section,
                              const std::string& key) const;
@@ -146,6 +913,14 @@ namespace inipp
 	      , const std::string& key
 	      , const T def) const
       {
+	  // values classified while loading need no parsing
+	  if constexpr (private_::typed_value::supported<T>()) {
+		  const private_::typed_value* tv = typed(sec, key);
+		  T rv;
+		  if (tv && tv->get(rv))
+			  return rv;
+	  }
+
 	  std::string src;
 	  try {
 		  src = get(sec, key);
@@ -175,202 +950,3485 @@ namespace inipp
 	      return dget(sec, key, def);
       } catch (...) { return def; }
 
+      // Durations such as "250ms", "1.5s" or "1h 30m" with the units ns,
+      // us, ms, s, m or min, h and d, truncated to the resolution of the
+      // default's type, and byte sizes such as "512", "64k" or "4GiB":
+      // k, M, G, T, P, E and KiB to EiB are powers of 1024, kB or KB, MB
+      // to EB powers of 1000. Fractions below a nanosecond or a byte are
+      // dropped. Missing entries and values that do not parse or fit
+      // return the default. With parse_options::typed_values the result
+      // is parsed once while loading.
+      template<typename Rep, typename Period>
+      std::chrono::duration<Rep, Period>
+      getval(const std::string& sec, const std::string& key,
+             const std::chrono::duration<Rep, Period> def) const;
+      inline std::uint64_t getsize(const std::string& sec,
+                                   const std::string& key,
+                                   std::uint64_t def) const;
+
+      // Runtime modifications. Sections are created on demand and kept
+      // when their last entry is erased. Not safe against concurrent
+      // readers; synchronize externally.
+      inline void set(const std::string& section, const std::string& key,
+                      const std::string& value);
+      inline void set(const std::string& key, const std::string& value);
+      inline bool erase(const std::string& section, const std::string& key);
+      inline bool erase(const std::string& key);
+
+      // Overrides from the environment. Every variable of envp (the
+      // process environment by default) mapped onto an entry by overlay
+      // is set once, with its value trimmed; returns how many were.
+      // Throws std::invalid_argument for an empty prefix without a map.
+      // Overridden entries are ordinary entries afterwards, so reading
+      // them costs nothing extra, and origin() tells them apart.
+      inline std::size_t apply_environment(const env_overlay& overlay,
+                                           char** envp = nullptr);
+
+      // Overrides from the command line, the arguments of options like
+      // --set section.key=value. Each is split like a line of the file
+      // (at the first '=', trimmed, comments removed) and the key at its
+      // last '.', so section names may contain dots; a key without a dot
+      // belongs to the default section. All overrides are validated
+      // before any is applied: a malformed one throws a syntax_error and
+      // leaves the configuration unchanged. Returns how many were set.
+      inline std::size_t
+      apply_overrides(const std::vector<std::string>& overrides);
+
+      // Layer, file and line that last set an entry. Tracking starts
+      // while loading with parse_options::track_origins, otherwise with
+      // the first environment or command line overlay applied; entries
+      // present before it report the unknown layer.
+      inline provenance origin(const std::string& section,
+                               const std::string& key) const;
+      inline provenance origin(const std::string& key) const;
+
+      // Incremented by every set/erase that changes a value, so cached
+      // conversions can be checked for staleness with one comparison.
+      inline std::uint64_t version() const;
+
+      // Shape and rehash counts of loading from a stream; all zero for
+      // other inifiles. Later modifications are not counted.
+      inline const load_stats& stats() const;
+
+      // Fingerprints of the parsed (section, key, value) triples, or of
+      // the entries of a single section. Neither depends on order,
+      // whitespace or comments in the file, and both are stable across
+      // hosts, builds and platforms.
+      inline digest fingerprint() const;
+      inline digest fingerprint(const std::string& section) const;
+
+      // Read-only images. write_image() stores the configuration as one
+      // pointer-free block of image_size() bytes at out, which must be
+      // 8-byte aligned. attach() returns an inifile answering get,
+      // section and fingerprint queries directly from such a block
+      // without parsing or copying it; the block must stay valid and
+      // unchanged while the inifile or its copies exist, which owner
+      // (if given) takes care of. Images are only read back on hosts
+      // with the same byte order. attach() checks every offset and hash
+      // table once, in time linear in the image size, and throws a
+      // syntax_error for a corrupt image; later changes to the block
+      // are not detected. Attached configurations throw a
+      // std::logic_error from set and erase.
+      inline std::size_t image_size() const;
+      inline void write_image(void* out) const;
+      inline static inifile attach(const void* image, std::size_t size,
+                                   std::shared_ptr<const void> owner =
+                                     nullptr);
+
+      // Batch lookups of many keys in one section, which is looked up
+      // only once. lookup() returns the values in the order of keys, and
+      // std::nullopt for missing keys; the views stay valid until the
+      // inifile is modified. getvals() converts into bound fields and
+      // returns how many were found and converted, which is also what
+      // their found flags tell; like getval it does not throw for
+      // missing sections or keys.
+      inline std::vector<std::optional<std::string_view>>
+      lookup(const std::string& section,
+             const std::vector<std::string_view>& keys) const;
+      inline std::size_t getvals(const std::string& section, field* fields,
+                                 std::size_t n) const;
+      template<std::size_t N>
+      std::size_t getvals(const std::string& section,
+                          field (&fields)[N]) const {
+        return this->getvals(section, fields, N);
+      }
+
+      // Bulk lookup of (section, key) pairs from any sections. Keys are
+      // hashed and their table slots prefetched a window ahead of being
+      // resolved, which overlaps the cache misses of configurations much
+      // larger than the CPU caches. Missing sections and keys yield
+      // std::nullopt; views are valid as with the lookup above.
+      inline std::vector<std::optional<std::string_view>>
+      lookup(const std::vector<key_ref>& keys) const;
+
       // TODO: copy, move
 
       // https://www.reddit.com/r/programming/comments/7f0ljb/check_out_my_new_c_library_to_parse_creating_ini/
       // TODO: overload operator []
 
     protected:
-      typedef std::unordered_map<std::string, std::string> kv_t;
-      typedef std::unordered_map<std::string, kv_t> kkv_t;
+      typedef std::pmr::polymorphic_allocator<char> allocator_type;
+      typedef private_::entry_table kv_t;
+
+      // allocator-aware, so the maps pass their resource on to it
+      struct section_t
+      {
+        typedef inifile::allocator_type allocator_type;
+
+        explicit section_t(const allocator_type& alloc)
+          : entries(alloc), hash(), id() {}
+        section_t(const section_t& other, const allocator_type& alloc)
+          : entries(other.entries, alloc), hash(other.hash), id(other.id) {}
+        section_t(section_t&& other, const allocator_type& alloc)
+          : entries(std::move(other.entries), alloc), hash(other.hash),
+            id(other.id) {}
+
+        kv_t entries;
+        digest hash;  // sum of entry hashes
+        digest id;    // hash of the section name
+      };
+
+      typedef std::pmr::unordered_map<std::pmr::string, section_t,
+                                      private_::string_hash,
+                                      private_::string_equal> kkv_t;
       kkv_t sections_;
-      kv_t defaultsection_;
-  };
+      section_t defaultsection_;
+      std::uint64_t version_;
+      digest fingerprint_;
 
-  namespace private_
-  {
-    inline std::string& rstrip(std::string& s, const std::string& c_to_strip);
-    inline std::string& lstrip(std::string& s, const std::string& c_to_strip);
+      // set for attached images, which replace the maps above
+      const char* image_;
+      std::shared_ptr<const void> image_owner_;
 
-    inline std::string& trim(std::string&& str,
-                            const std::string& whitespace = " \t\n\r\f\v");
-    inline std::string& trim(std::string& str,
-                            const std::string& whitespace = " \t\n\r\f\v");
+      // parse_options::typed_values
+      bool typed_;
+      // entries record their provenance
+      bool origins_;
 
+      load_stats stats_;
 
-    inline bool split(const std::string& in, const std::string& sep,
-                      std::string& first, std::string& second);
+      inline const private_::typed_value* typed(const std::string& section,
+                                                const std::string& key) const;
 
-    inline std::string& strip_comment(std::string& s, const std::string& mark);
-    inline std::string& strip_comment(std::string& s);
-  }
+      // A section in either representation, for code serving both.
+      struct section_ref
+      {
+        const section_t* map;
+        const private_::image_section* image;
+        const char* base;
 
-  inifile::inifile(std::ifstream&& infile)
-	  : inifile(infile) {}
+        explicit operator bool() const { return map || image; }
+      };
 
-  inifile::inifile(std::ifstream& infile) {
-    kv_t* cursec = &this->defaultsection_;
-    std::string line;
+      struct image_layout
+      {
+        std::size_t sections;
+        std::size_t table;
+        std::size_t slots;
+        std::size_t entries;
+        std::size_t tables;
+        std::size_t strings;
+        std::size_t size;
+      };
 
-    while(std::getline(infile, line)) {
-      // trim line
-      line = private_::trim(line);
-      // remove comments
-      private_::strip_comment(line);
+      inline section_ref default_section() const;
+      inline section_ref find_section(std::string_view name) const;
+      inline section_ref find_image_section(std::string_view name,
+                                            std::uint64_t hash) const;
+      template<typename F>
+      inline void for_each_section(F&& f) const;
+      inline std::size_t section_count() const;
+      inline image_layout layout_image() const;
+      inline void check_writable() const;
+      inline void track_origins();
 
-      // ignore empty lines
-      if(line.empty()) {
-        continue;
-      }
+      inline static bool find_entry(const section_ref& sec,
+                                    std::string_view key,
+                                    std::string_view& value);
+      inline static bool find_image_entry(const section_ref& sec,
+                                          std::string_view key,
+                                          std::uint64_t hash,
+                                          std::string_view& value);
+      template<typename Key, typename Found>
+      inline static void probe(const section_ref& sec, std::size_t n,
+                               Key&& key, Found&& found);
+      template<typename F>
+      inline static void for_each_entry(const section_ref& sec, F&& f);
+      inline static std::size_t section_size(const section_ref& sec);
+      inline static digest section_hash(const section_ref& sec);
+      inline static void diff_section(const section_ref& from,
+                                      const section_ref& to,
+                                      bool default_section,
+                                      std::string_view name,
+                                      std::vector<change>& changes);
 
-      // section?
-      if(line[0] == '[') {
-        if(line[line.size() - 1] != ']') {
-          throw syntax_error("The section '" + line +
-                             "' is missing a closing bracket.");
-        }
+      inline static bool find_origin(const section_ref& sec,
+                                     std::string_view key,
+                                     provenance& from);
 
-        line = private_::trim(line.substr(1, line.size() - 2));
-        cursec = &this->sections_[line];
-        continue;
-      }
+      inline section_t& add_section(std::string_view name, bool& created);
+      inline section_t& modify_section(std::string_view name);
+      inline static bool assign(section_t& sec, std::string_view key,
+                                std::string_view value,
+                                const provenance& from);
+      inline void set(section_t& sec, std::string_view key,
+                      std::string_view value, const provenance& from);
+      inline bool erase(section_t& sec, const std::string& key);
+  };
 
-      // entry: split by "=", trim and set
-      std::string key;
-      std::string value;
+#ifdef INIPP_WITH_SHM
+  // Configurations shared between processes through POSIX shared memory
+  // objects. shm_publish() creates the object name (e.g. "/app-config",
+  // it must not exist yet) holding the image of cfg. shm_attach() maps
+  // it read-only and returns an inifile served from the mapping, so
+  // every process shares the same physical pages. Removing the object
+  // does not affect attached configurations; publish updates under a
+  // new name. The image is validated once when attached, so the object
+  // must not be writable by untrusted processes.
+  inline void shm_publish(const std::string& name, const inifile& cfg);
+  inline inifile shm_attach(const std::string& name);
+  inline bool shm_remove(const std::string& name);
+#endif
 
-      if(private_::split(line, "=", key, value)) {
-        (*cursec)[private_::trim(key)] = private_::trim(value);
-        continue;
-      }
+  template<typename T>
+  T inisection::getval(const std::string& key, const T def) const {
+    return this->_ini.getval(this->_section, key, def);
+  }
 
-      // throw exception on invalid line
-      throw syntax_error("The line '" + line + "' is invalid.");
-    }
+  std::uint64_t inisection::getsize(const std::string& key,
+                                    std::uint64_t def) const {
+    return this->_ini.getsize(this->_section, key, def);
   }
 
-  std::string inifile::get(const std::string& section,
-                           const std::string& key) const {
-    if(!this->sections_.count(section)) {
-      throw unknown_section_error(section);
+  template<typename Rep, typename Period>
+  std::chrono::duration<Rep, Period>
+  inifile::getval(const std::string& sec, const std::string& key,
+                  const std::chrono::duration<Rep, Period> def) const {
+    const private_::typed_value* tv = this->typed(sec, key);
+    std::int64_t ns;
+
+    if(tv && tv->tag == private_::typed_value::duration) {
+      ns = tv->i;
+    }
+    else {
+      std::string src;
+      try {
+        src = this->get(sec, key);
+      }
+      catch(...) {
+        return def;
+      }
+      if(!private_::parse_duration(src, ns)) {
+        return def;
+      }
     }
 
-    if(!this->sections_.find(section)->second.count(key)) {
-      throw unknown_entry_error(section, key);
+    if constexpr(std::is_integral<Rep>::value) {
+      const long double count = std::chrono::duration<long double, Period>(
+        std::chrono::nanoseconds(ns)).count();
+      if(count < std::numeric_limits<Rep>::min() ||
+         count > std::numeric_limits<Rep>::max()) {
+        return def;
+      }
     }
 
-    return this->sections_.find(section)->second.find(key)->second;
+    return std::chrono::duration_cast<std::chrono::duration<Rep, Period>>(
+      std::chrono::nanoseconds(ns));
   }
 
-  std::string inifile::get(const std::string& key) const {
-    if(!this->defaultsection_.count(key)) {
-      throw unknown_entry_error(key);
-    }
+  std::uint64_t inifile::getsize(const std::string& sec,
+                                 const std::string& key,
+                                 std::uint64_t def) const {
+    const private_::typed_value* tv = this->typed(sec, key);
 
-    return this->defaultsection_.find(key)->second;
-  };
+    if(tv && tv->tag == private_::typed_value::size) {
+      return tv->u;
+    }
+    if(tv && tv->tag == private_::typed_value::integer) {
+      return tv->i >= 0 ? tv->u : def;
+    }
 
-  std::string inifile::dget(const std::string& section,
-                            const std::string& key,
-                            const std::string& default_value) const {
+    std::string src;
     try {
-      return this->get(section, key);
+      src = this->get(sec, key);
+    }
+    catch(...) {
+      return def;
     }
-    catch(unknown_section_error& ex) { /* ignore */ }
-    catch(unknown_entry_error& ex) { /* ignore */ }
 
-    return default_value;
+    std::uint64_t bytes;
+    return private_::parse_size(src, bytes) ? bytes : def;
   }
 
-  std::string inifile::dget(const std::string& key,
-                            const std::string& default_value) const {
-    try {
-      return this->get(key);
-    }
-    catch(unknown_entry_error& ex) { /* ignore */ }
+  namespace private_
+  {
+    // Per-thread cache of reloadable snapshots. Holder ids are never
+    // reused. Destroying a holder bumps the holder generation; a thread
+    // seeing a new generation drops the slots of all other holders, so
+    // snapshots of destroyed holders do not live as long as the thread.
+    struct snapshot_slot
+    {
+      std::uint64_t holder;
+      std::uint64_t epoch;
+      std::shared_ptr<const inifile> cfg;
+    };
 
-    return default_value;
-  }
+    static const std::size_t snapshot_slots = 4;
 
-  inisection inifile::section(const std::string& section) const {
-    if(!this->sections_.count(section)) {
-      throw unknown_section_error(section);
-    }
+    struct snapshot_cache
+    {
+      snapshot_slot slots[snapshot_slots];
+      std::uint64_t generation;
+    };
+  }
 
-    return inisection(section, *this);
+  // Holder for a configuration that is replaced at runtime. Readers get
+  // the current inifile through a per-thread cached snapshot which is
+  // validated with a single relaxed load of the holder's epoch; only
+  // after a publish() does a reader take the lock and copy the new
+  // shared_ptr. A thread's snapshot stays alive until that thread calls
+  // current() again after a publish or after any holder was destroyed,
+  // or exits.
+  class reloadable
+  {
+    public:
+      // Null configurations throw std::invalid_argument, here and in
+      // publish().
+      explicit inline reloadable(std::shared_ptr<const inifile> initial);
+      explicit inline reloadable(inifile&& initial);
+
+      reloadable(const reloadable&) = delete;
+      reloadable& operator=(const reloadable&) = delete;
+
+      inline ~reloadable();
+
+      inline void publish(std::shared_ptr<const inifile> cfg);
+      inline void publish(inifile&& cfg);
+
+      // Parses a new configuration from the stream and publishes it.
+      inline void reload(std::istream& in);
+
+      // Change notifications. Callbacks receive the changes matching
+      // their subscription from one publish() as a single batch. They
+      // run one at a time on a dispatcher thread owned by the holder, so
+      // publishing never waits for them. Batches already queued when a
+      // subscription is cancelled are dropped. Exceptions thrown by a
+      // callback are swallowed; the batch counts as delivered and the
+      // subscription stays in place.
+      typedef std::function<void(const std::vector<change>&)> callback;
+
+      inline std::uint64_t subscribe(const std::string& section,
+                                     const std::string& key, callback cb);
+      inline std::uint64_t subscribe(const std::string& section,
+                                     callback cb);
+      inline std::uint64_t subscribe_default(const std::string& key,
+                                             callback cb);
+      inline void unsubscribe(std::uint64_t id);
+
+      // The reference stays valid until the calling thread calls
+      // current() again.
+      inline const inifile& current() const;
+
+      // Locked, reference counted access for code that keeps a snapshot
+      // beyond that.
+      inline std::shared_ptr<const inifile> snapshot() const;
+
+      // Incremented by every publish().
+      inline std::uint64_t epoch() const;
+
+    protected:
+      // (default section, whole section, section, key)
+      typedef std::tuple<bool, bool, std::string, std::string> topic_t;
+      typedef std::pair<std::uint64_t, std::vector<change>> batch_t;
+
+      inline const inifile& refresh(private_::snapshot_slot& slot) const;
+      inline std::uint64_t subscribe(topic_t topic, callback cb);
+      inline void notify(const inifile& from, const inifile& to);
+      inline void dispatch();
+
+      const std::uint64_t id_;
+      std::atomic<std::uint64_t> epoch_;
+      mutable std::mutex mutex_;
+      std::shared_ptr<const inifile> current_;
+
+      // serializes publishers so notifications arrive in order
+      std::mutex publish_mutex_;
+
+      std::mutex subs_mutex_;
+      std::condition_variable subs_cv_;
+      std::uint64_t next_sub_;
+      std::multimap<topic_t, std::uint64_t> topics_;
+      std::map<std::uint64_t, callback> callbacks_;
+      std::deque<batch_t> queue_;
+      bool stopping_;
+      std::thread dispatcher_;
   };
 
-  inisection::inisection(const std::string& section, const inifile& ini)
-    : _section(section),
-      _ini(ini) {
-    /* empty */
+  // Stream buffer reading from another stream buffer and decompressing
+  // gzip (with INIPP_WITH_ZLIB) or zstd (with INIPP_WITH_ZSTD) data on
+  // the fly, one block at a time. Input without a known magic number is
+  // passed through unchanged.
+  class decompress_streambuf : public std::streambuf
+  {
+    public:
+      explicit inline decompress_streambuf(std::streambuf* source,
+                                           std::size_t blocksize = 1 << 16);
+      inline ~decompress_streambuf();
+
+      decompress_streambuf(const decompress_streambuf&) = delete;
+      decompress_streambuf& operator=(const decompress_streambuf&) = delete;
+
+    protected:
+      enum format_t { plain, gzip, zstd };
+
+      inline int_type underflow() override;
+      inline bool fill();
+
+      std::streambuf* source_;
+      format_t format_;
+      std::vector<char> in_;
+      std::vector<char> out_;
+      std::size_t inpos_;
+      std::size_t inlen_;
+      bool done_;
+      bool pending_;  // inside an unfinished gzip member or zstd frame
+
+#ifdef INIPP_WITH_ZLIB
+      z_stream zlib_;
+#endif
+#ifdef INIPP_WITH_ZSTD
+      ZSTD_DStream* zstd_;
+#endif
+  };
+
+  // Input stream over a decompress_streambuf. Decompression errors are
+  // thrown from the reading function as inipp::syntax_error, so
+  //
+  //   std::ifstream file("app.conf.gz", std::ios::binary);
+  //   inipp::decompressing_istream in(file);
+  //   inipp::inifile cfile(in);
+  //
+  // either parses the whole file or throws.
+  class decompressing_istream : public std::istream
+  {
+    public:
+      explicit inline decompressing_istream(std::istream& source,
+                                            std::size_t blocksize = 1 << 16);
+
+    protected:
+      decompress_streambuf buf_;
+  };
+
+  // Lossless view of an ini file: keeps the original bytes of every line
+  // and applies set/erase by splicing only the affected regions when the
+  // document is written out again. Comments, blank lines, ordering and
+  // line endings of untouched lines survive unchanged.
+  class inidocument
+  {
+    public:
+      explicit inline inidocument(std::istream& in);
+      explicit inline inidocument(std::string buffer);
+
+      inline std::string get(const std::string& section,
+                             const std::string& key) const;
+      inline std::string get(const std::string& key) const;
+
+      inline void set(const std::string& section, const std::string& key,
+                      const std::string& value);
+      inline void set(const std::string& key, const std::string& value);
+
+      inline bool erase(const std::string& section, const std::string& key);
+      inline bool erase(const std::string& key);
+
+      inline void write(std::ostream& out) const;
+      inline std::string str() const;
+
+    protected:
+      static constexpr std::size_t npos = std::string::npos;
+
+      enum class state_t : char { original, replaced, deleted };
+
+      struct line_t
+      {
+        std::size_t begin;    // offset into buffer_, npos for inserted lines
+        std::size_t vbegin;   // value range of entry lines
+        std::size_t vend;
+        std::size_t shadowed; // earlier line setting the same key, or npos
+        state_t state;
+      };
+
+      struct section_t
+      {
+        std::size_t anchor;   // insert position for new entries
+        std::size_t header = npos;  // header line inserted by set()
+        std::unordered_map<std::string, std::size_t> entries;
+      };
+
+      inline void parse();
+      inline void set(section_t& sec, const std::string& key,
+                      const std::string& value);
+      inline bool erase(section_t& sec, const std::string& key);
+      inline std::size_t insert(std::size_t anchor, std::string text);
+      inline std::size_t line_end(std::size_t idx) const;
+      inline void write_inserts(std::ostream& out, std::size_t anchor,
+                                bool& bol) const;
+
+      std::string buffer_;
+      std::string newline_;
+      std::size_t nlines_;
+      std::vector<line_t> lines_;   // parsed lines followed by inserted ones
+
+      // Insert positions are line indices: anchor i places text before
+      // line i, anchors past the parsed lines follow the inserted line
+      // anchor - 1 and npos appends to the end of the document.
+      std::map<std::size_t, std::vector<std::size_t>> inserts_;
+      std::unordered_map<std::size_t, std::string> values_;
+      std::unordered_map<std::size_t, std::string> texts_;
+
+      std::unordered_map<std::string, section_t> sections_;
+      section_t defaultsection_;
+  };
+
+  namespace private_
+  {
+    // Result of tokenizing a single line. All views point into the line
+    // passed to tokenize().
+    struct line_tokens
+    {
+      enum kind_t { blank, section, entry, bad_section, bad_line };
+
+      kind_t kind;
+      std::string_view text;  // trimmed bad line, for error messages
+      std::string_view key;   // section name or entry key
+      std::string_view value;
+    };
+
+    inline digest hash128(std::string_view s, digest seed);
+    inline digest hash_entry(std::string_view key, std::string_view value);
+    inline digest hash_section(const digest& id, const digest& contents);
+    inline std::uint64_t image_hash(std::string_view s);
+
+    inline snapshot_cache& thread_snapshots();
+    inline std::atomic<std::uint64_t>& holder_generation();
+    inline std::uint64_t next_holder_id();
+
+    // Classes of bytes, one lookup per byte while tokenizing.
+    enum byte_class : std::uint8_t
+    {
+      space_byte = 1,    // " \t\n\v\f\r"
+      comment_byte = 2,  // '#' and ';'
+      equals_byte = 4,
+    };
+
+    struct byte_table
+    {
+      std::uint8_t classes[256];
+
+      constexpr byte_table() : classes() {
+        for(char c : { ' ', '\t', '\n', '\v', '\f', '\r' }) {
+          this->classes[static_cast<unsigned char>(c)] = space_byte;
+        }
+        this->classes[static_cast<unsigned char>('#')] = comment_byte;
+        this->classes[static_cast<unsigned char>(';')] = comment_byte;
+        this->classes[static_cast<unsigned char>('=')] = equals_byte;
+      }
+
+      unsigned operator[](char c) const {
+        return this->classes[static_cast<unsigned char>(c)];
+      }
+    };
+
+    inline constexpr byte_table byte_classes{};
+
+    inline bool is_space(char c);
+    inline std::string_view trim(std::string_view str);
+    inline const char* find_line_break(const char* p, const char* end);
+    inline std::string_view skip_bom(std::string_view line);
+    inline std::size_t find_invalid_utf8(std::string_view s);
+    inline std::size_t check_utf8(const char* base, std::size_t& checked,
+                                  std::size_t end, bool final);
+    inline line_tokens tokenize(std::string_view line);
+
+    inline void check_representable(std::string_view s, const char* reject,
+                                    const char* what);
+    inline void check_representable(std::string_view key,
+                                    std::string_view value);
   }
 
-  inline std::string inisection::name() const {
-    return this->_section;
+  template<typename Handler>
+  void parse(std::istream& in, Handler&& handler,
+             const parse_options& options,
+             std::pmr::memory_resource* resource) {
+    std::streambuf* source = in.rdbuf();
+    const std::size_t maxline = options.max_line_length
+      ? options.max_line_length : std::numeric_limits<std::size_t>::max();
+    std::pmr::vector<char> buf(options.max_line_length
+                                 ? std::max(options.buffer_size, maxline + 1)
+                                 : std::max<std::size_t>(options.buffer_size,
+                                                         1),
+                               resource);
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    bool eof = (source == nullptr);
+
+    std::pmr::string section(resource);
+    parse_event ev = { parse_event::header, true, {}, {}, {}, 0 };
+    bool skip_lf = false;  // after a CR ending the previous block
+
+    // With validate_utf8 every block is checked as it is read, up to
+    // checked; bad is the offset of the first invalid sequence in buf,
+    // reported once the line holding it is reached.
+    std::size_t checked = 0;
+    std::size_t bad = std::string_view::npos;
+
+    while(true) {
+      const char* base = buf.data();
+
+      if(skip_lf && begin < end) {
+        begin += (base[begin] == '\n');
+        skip_lf = false;
+      }
+
+      const char* nl = private_::find_line_break(base + begin, base + end);
+
+      if(!nl && !eof) {
+        if(end - begin > maxline) {
+          throw syntax_error("Line " + std::to_string(ev.line + 1) +
+                             " is longer than " + std::to_string(maxline) +
+                             " bytes.");
+        }
+
+        // move the partial line to the front and refill
+        std::memmove(buf.data(), base + begin, end - begin);
+        end -= begin;
+        checked -= begin;
+        bad -= (bad != std::string_view::npos) ? begin : 0;
+        begin = 0;
+
+        // only without a line limit can a line fill the whole buffer
+        if(end == buf.size()) {
+          buf.resize(2 * buf.size());
+        }
+
+        std::streamsize n = source->sgetn(buf.data() + end,
+                                          buf.size() - end);
+        if(n > 0) {
+          end += static_cast<std::size_t>(n);
+        }
+        else {
+          eof = true;
+        }
+
+        if(options.validate_utf8 && bad == std::string_view::npos) {
+          bad = private_::check_utf8(buf.data(), checked, end, eof);
+        }
+        continue;
+      }
+
+      if(!nl) {
+        if(begin == end) {
+          break;
+        }
+        // last line without a line break
+        nl = base + end;
+      }
+
+      const std::size_t len = nl - (base + begin);
+      std::size_t next = std::min<std::size_t>(len + begin + 1, end);
+      ++ev.line;
+
+      // CR LF is a single line break, possibly split between blocks
+      if(nl < base + end && *nl == '\r') {
+        if(next < end) {
+          next += (base[next] == '\n');
+        }
+        else {
+          skip_lf = true;
+        }
+      }
+
+      if(len > maxline) {
+        throw syntax_error("Line " + std::to_string(ev.line) +
+                           " is longer than " + std::to_string(maxline) +
+                           " bytes.");
+      }
+
+      std::string_view line(base + begin, len);
+
+      if(bad < next) {
+        source->pubseekoff(-static_cast<std::streamoff>(end - next),
+                           std::ios::cur, std::ios::in);
+        throw syntax_error("Line " + std::to_string(ev.line) +
+                           " is not valid UTF-8 at byte " +
+                           std::to_string(bad - begin + 1) + ".");
+      }
+
+      if(ev.line == 1) {
+        line = private_::skip_bom(line);
+      }
+
+      const private_::line_tokens tok = private_::tokenize(line);
+      begin = next;
+
+      // ignore empty lines and comments
+      if(tok.kind == private_::line_tokens::blank) {
+        continue;
+      }
+
+      // section?
+      if(tok.kind == private_::line_tokens::section) {
+        section.assign(tok.key.data(), tok.key.size());
+        ev.kind = parse_event::header;
+        ev.default_section = false;
+        ev.section = section;
+        ev.key = ev.value = std::string_view();
+        handler(static_cast<const parse_event&>(ev));
+        continue;
+      }
+
+      // entry: already split by "=" and trimmed
+      if(tok.kind == private_::line_tokens::entry) {
+        ev.kind = parse_event::entry;
+        ev.key = tok.key;
+        ev.value = tok.value;
+        handler(static_cast<const parse_event&>(ev));
+        continue;
+      }
+
+      // give back what was read past the invalid line, so parsing can
+      // be resumed from there
+      source->pubseekoff(-static_cast<std::streamoff>(end - next),
+                         std::ios::cur, std::ios::in);
+
+      // throw exception on invalid line
+      if(tok.kind == private_::line_tokens::bad_section) {
+        throw syntax_error("The section '" + std::string(tok.text) +
+                           "' is missing a closing bracket.");
+      }
+
+      throw syntax_error("The line '" + std::string(tok.text) +
+                         "' is invalid.");
+    }
+
+    in.setstate(std::ios::eofbit | std::ios::failbit);
   }
 
-  inline std::string inisection::get(const std::string& key) const {
-    return this->_ini.get(this->_section, key);
+  inifile::inifile(std::ifstream&& infile, const parse_options& options,
+                   std::pmr::memory_resource* resource)
+	  : inifile(infile, options, resource) {}
+
+  inifile::inifile(std::pmr::memory_resource* resource)
+    : sections_(resource),
+      defaultsection_(resource),
+      version_(0),
+      fingerprint_(),
+      image_(nullptr),
+      typed_(false),
+      origins_(false) {
+    this->defaultsection_.id = private_::hash128("", { 0, 1 });
+    this->fingerprint_ += private_::hash_section(this->defaultsection_.id,
+                                                 this->defaultsection_.hash);
   }
 
-  inline std::string inisection::dget(const std::string& key,
-                                      const std::string& default_val) const {
-    return this->_ini.dget(this->_section, key, default_val);
+  inifile::inifile(std::istream& infile, const parse_options& options,
+                   std::pmr::memory_resource* resource)
+    : sections_(resource),
+      defaultsection_(resource),
+      version_(0),
+      fingerprint_(),
+      image_(nullptr),
+      typed_(options.typed_values),
+      origins_(false) {
+    section_t* cursec = &this->defaultsection_;
+    bool created;
+
+    this->defaultsection_.id = private_::hash128("", { 0, 1 });
+    if(this->typed_) {
+      this->defaultsection_.entries.enable_typed();
+    }
+    if(options.track_origins) {
+      this->track_origins();
+    }
+
+    // a section's size in the hint, where it has one
+    const inifile* hint = options.size_hint;
+    auto expected = [&](const section_ref& sec) {
+      return sec ? section_size(sec) : options.expected_entries;
+    };
+
+    const std::size_t sections = hint ? hint->section_count()
+                                      : options.expected_sections;
+    if(sections) {
+      this->sections_.reserve(sections);
+    }
+    this->defaultsection_.entries.reserve(
+      hint ? expected(hint->default_section()) : options.expected_entries);
+
+    parse(infile, [&](const parse_event& ev) {
+      if(ev.kind == parse_event::header) {
+        const std::size_t buckets = this->sections_.bucket_count();
+        cursec = &this->add_section(ev.section, created);
+
+        if(created) {
+          this->stats_.section_rehashes +=
+            (this->sections_.bucket_count() != buckets &&
+             this->sections_.size() > 1);
+          cursec->entries.reserve(
+            hint ? expected(hint->find_section(ev.section))
+                 : options.expected_entries);
+        }
+      }
+      else {
+        const std::size_t buckets = cursec->entries.buckets();
+        assign(*cursec, ev.key, ev.value,
+               { provenance::file, options.file_id,
+                 static_cast<std::uint32_t>(ev.line) });
+        this->stats_.entry_rehashes +=
+          (cursec->entries.buckets() != buckets && buckets != 0);
+      }
+    }, options, resource);
+
+    // combine once all sections are complete
+    this->stats_.sections = this->sections_.size();
+    this->defaultsection_.entries.shrink_to_fit();
+    this->fingerprint_ += private_::hash_section(this->defaultsection_.id,
+                                                 this->defaultsection_.hash);
+    this->stats_.entries = this->defaultsection_.entries.size();
+    this->stats_.largest_section = this->defaultsection_.entries.size();
+    for(auto& sec : this->sections_) {
+      sec.second.entries.shrink_to_fit();
+      this->fingerprint_ += private_::hash_section(sec.second.id,
+                                                   sec.second.hash);
+      this->stats_.entries += sec.second.entries.size();
+      this->stats_.largest_section =
+        std::max(this->stats_.largest_section, sec.second.entries.size());
+    }
   }
 
-  inline std::string& private_::rstrip( std::string& s
-		  		      , const std::string& c_to_strip)
-  {
-    size_t endpos = s.find_last_not_of(c_to_strip);
-    if (endpos == std::string::npos) return s.erase();
-    return s.erase(endpos+1);
+  std::string inifile::get(const std::string& section,
+                           const std::string& key) const {
+    const section_ref sec = this->find_section(section);
+
+    if(!sec) {
+      throw unknown_section_error(section);
+    }
+
+    std::string_view value;
+
+    if(!find_entry(sec, key, value)) {
+      throw unknown_entry_error(section, key);
+    }
+
+    return std::string(value);
   }
 
-  inline std::string& private_::lstrip( std::string& s
-		  		      , const std::string& c_to_strip)
-  {
-    size_t startpos = s.find_first_not_of(c_to_strip);
-    if (startpos == std::string::npos) return s.erase();
-    return s.erase(0, startpos);
+  std::string inifile::get(const std::string& key) const {
+    std::string_view value;
+
+    if(!find_entry(this->default_section(), key, value)) {
+      throw unknown_entry_error(key);
+    }
+
+    return std::string(value);
+  };
+
+  std::string inifile::dget(const std::string& section,
+                            const std::string& key,
+                            const std::string& default_value) const {
+    try {
+      return this->get(section, key);
+    }
+    catch(unknown_section_error& ex) { /* ignore */ }
+    catch(unknown_entry_error& ex) { /* ignore */ }
+
+    return default_value;
   }
 
-  inline std::string& private_::trim(std::string&& str,
-                                    const std::string& whitespace) {
-	  return rstrip(lstrip(str, whitespace), whitespace);
+  std::string inifile::dget(const std::string& key,
+                            const std::string& default_value) const {
+    try {
+      return this->get(key);
+    }
+    catch(unknown_entry_error& ex) { /* ignore */ }
+
+    return default_value;
   }
 
-  inline std::string& private_::trim(std::string& str,
-                                    const std::string& whitespace) {
-	  return rstrip(lstrip(str, whitespace), whitespace);
+  void inifile::set(const std::string& section, const std::string& key,
+                    const std::string& value) {
+    this->check_writable();
+    this->set(this->modify_section(section), key, value,
+              { provenance::runtime });
   }
 
+  void inifile::set(const std::string& key, const std::string& value) {
+    this->check_writable();
+    this->set(this->defaultsection_, key, value, { provenance::runtime });
+  }
 
+  void inifile::set(section_t& sec, std::string_view key,
+                    std::string_view value, const provenance& from) {
+    const digest old = private_::hash_section(sec.id, sec.hash);
 
-  inline bool private_::split(const std::string& in, const std::string& sep,
-                              std::string& first, std::string& second) {
-    size_t eqpos = in.find(sep);
+    if(assign(sec, key, value, from)) {
+      this->fingerprint_ -= old;
+      this->fingerprint_ += private_::hash_section(sec.id, sec.hash);
+      ++this->version_;
+    }
+  }
 
-    if(eqpos == std::string::npos) {
-      return false;
+  inifile::section_t& inifile::add_section(std::string_view name,
+                                           bool& created) {
+    auto it = private_::find(this->sections_, name);
+    created = (it == this->sections_.end());
+
+    if(created) {
+      it = this->sections_.emplace(std::piecewise_construct,
+                                   std::forward_as_tuple(name),
+                                   std::forward_as_tuple()).first;
+      it->second.id = private_::hash128(name, { 0, 2 });
+      if(this->typed_) {
+        it->second.entries.enable_typed();
+      }
+      if(this->origins_) {
+        it->second.entries.enable_origins();
+      }
+    }
+
+    return it->second;
+  }
+
+  // add_section for modifications, which keep the fingerprint current
+  inifile::section_t& inifile::modify_section(std::string_view name) {
+    bool created;
+    section_t& sec = this->add_section(name, created);
+
+    if(created) {
+      this->fingerprint_ += private_::hash_section(sec.id, sec.hash);
     }
 
-    first = in.substr(0, eqpos);
-    second = in.substr(eqpos + sep.size(), in.size() - eqpos - sep.size());
+    return sec;
+  }
+
+  bool inifile::assign(section_t& sec, std::string_view key,
+                       std::string_view value, const provenance& from) {
+    std::size_t i = sec.entries.find(key);
+
+    if(i == kv_t::npos) {
+      i = sec.entries.size();
+      sec.entries.insert(key, value);
+    }
+    else if(sec.entries.value(i) != value) {
+      sec.hash -= private_::hash_entry(key, sec.entries.value(i));
+      sec.entries.assign(i, value);
+    }
+    else {
+      // unchanged, but now coming from a later layer
+      sec.entries.set_origin(i, from);
+      return false;
+    }
 
+    sec.entries.set_origin(i, from);
+    sec.hash += private_::hash_entry(key, value);
     return true;
   }
 
-  inline std::string& private_::strip_comment(std::string& s, const std::string& mark)
-  {
-	  size_t pos = s.find_first_of(mark);
-	  if (pos != std::string::npos) s.erase(pos);
-	  return s;
+  std::size_t inifile::apply_environment(const env_overlay& overlay,
+                                         char** envp) {
+    if(overlay.prefix.empty() && !overlay.map) {
+      throw std::invalid_argument("An environment overlay needs a prefix "
+                                  "or a map function.");
+    }
+
+    this->check_writable();
+    this->track_origins();
+
+    if(!envp) {
+#if defined(_WIN32)
+      envp = _environ;
+#else
+      envp = environ;
+#endif
+    }
+
+    const std::string_view sep = overlay.separator;
+    std::string section, key;
+    std::size_t applied = 0;
+
+    for(; *envp; ++envp) {
+      const std::string_view var = *envp;
+      const std::size_t eq = var.find('=');
+
+      if(eq == std::string_view::npos) {
+        continue;
+      }
+
+      std::string_view name = var.substr(0, eq);
+
+      if(!overlay.prefix.empty()) {
+        if(name.substr(0, overlay.prefix.size()) != overlay.prefix ||
+           name.substr(overlay.prefix.size(), sep.size()) != sep) {
+          continue;
+        }
+        name.remove_prefix(overlay.prefix.size() + sep.size());
+      }
+
+      bool default_section = false;
+      section.clear();
+      key.clear();
+
+      if(overlay.map) {
+        if(!overlay.map(name, section, key, default_section)) {
+          continue;
+        }
+      }
+      else {
+        const std::size_t pos =
+          sep.empty() ? std::string_view::npos : name.find(sep);
+
+        if(pos == std::string_view::npos) {
+          default_section = true;
+          key = name;
+        }
+        else {
+          section = name.substr(0, pos);
+          key = name.substr(pos + sep.size());
+        }
+
+        if(overlay.lowercase) {
+          for(std::string* s : { &section, &key }) {
+            for(char& c : *s) {
+              if(c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+              }
+            }
+          }
+        }
+      }
+
+      if(key.empty() || (!default_section && section.empty())) {
+        continue;
+      }
+
+      section_t& sec = default_section ? this->defaultsection_
+                                       : this->modify_section(section);
+
+      this->set(sec, key, private_::trim(var.substr(eq + 1)),
+                { provenance::environment });
+      ++applied;
+    }
+
+    return applied;
   }
 
-  inline std::string& private_::strip_comment(std::string& s)
-  {
-	  return strip_comment(strip_comment(s, "#"), ";");
+  std::size_t
+  inifile::apply_overrides(const std::vector<std::string>& overrides) {
+    struct setting
+    {
+      std::string_view section;
+      std::string_view key;
+      std::string_view value;
+      bool default_section;
+    };
+
+    this->check_writable();
+
+    std::vector<setting> settings;
+    settings.reserve(overrides.size());
+
+    for(const std::string& text : overrides) {
+      const private_::line_tokens tok =
+        text.find_first_of("\r\n") == std::string::npos
+          ? private_::tokenize(text) : private_::line_tokens();
+      setting s = { {}, tok.key, tok.value, true };
+
+      if(tok.kind == private_::line_tokens::entry) {
+        const std::size_t dot = tok.key.rfind('.');
+
+        if(dot != std::string_view::npos) {
+          s.section = private_::trim(tok.key.substr(0, dot));
+          s.key = private_::trim(tok.key.substr(dot + 1));
+          s.default_section = false;
+        }
+      }
+
+      if(tok.kind != private_::line_tokens::entry || s.key.empty() ||
+         (!s.default_section && s.section.empty())) {
+        throw syntax_error("The override '" + text +
+                           "' is not of the form section.key=value.");
+      }
+
+      settings.push_back(s);
+    }
+
+    this->track_origins();
+
+    std::uint32_t pos = 0;
+
+    for(const setting& s : settings) {
+      section_t& sec = s.default_section ? this->defaultsection_
+                                         : this->modify_section(s.section);
+      this->set(sec, s.key, s.value, { provenance::command_line, 0, ++pos });
+    }
+
+    return settings.size();
+  }
+
+  provenance inifile::origin(const std::string& section,
+                             const std::string& key) const {
+    const section_ref sec = this->find_section(section);
+
+    if(!sec) {
+      throw unknown_section_error(section);
+    }
+
+    provenance from;
+
+    if(!find_origin(sec, key, from)) {
+      throw unknown_entry_error(section, key);
+    }
+
+    return from;
+  }
+
+  provenance inifile::origin(const std::string& key) const {
+    provenance from;
+
+    if(!find_origin(this->default_section(), key, from)) {
+      throw unknown_entry_error(key);
+    }
+
+    return from;
+  }
+
+  bool inifile::find_origin(const section_ref& sec, std::string_view key,
+                            provenance& from) {
+    if(!sec.map) {
+      // images keep no provenance
+      std::string_view value;
+      return find_entry(sec, key, value);
+    }
+
+    const std::size_t i = sec.map->entries.find(key);
+
+    if(i == kv_t::npos) {
+      return false;
+    }
+
+    from = sec.map->entries.origin(i);
+    return true;
+  }
+
+  void inifile::track_origins() {
+    if(this->origins_) {
+      return;
+    }
+
+    this->origins_ = true;
+    this->defaultsection_.entries.enable_origins();
+    for(auto& sec : this->sections_) {
+      sec.second.entries.enable_origins();
+    }
+  }
+
+  bool inifile::erase(const std::string& section, const std::string& key) {
+    this->check_writable();
+
+    auto sec = private_::find(this->sections_, section);
+
+    if(sec == this->sections_.end()) {
+      return false;
+    }
+
+    return this->erase(sec->second, key);
+  }
+
+  bool inifile::erase(const std::string& key) {
+    this->check_writable();
+    return this->erase(this->defaultsection_, key);
+  }
+
+  const private_::typed_value*
+  inifile::typed(const std::string& section, const std::string& key) const {
+    if(!this->typed_) {
+      return nullptr;
+    }
+
+    auto sec = private_::find(this->sections_, section);
+
+    if(sec == this->sections_.end()) {
+      return nullptr;
+    }
+
+    const std::size_t i = sec->second.entries.find(key);
+    return (i == kv_t::npos) ? nullptr : sec->second.entries.typed(i);
+  }
+
+  void inifile::check_writable() const {
+    if(this->image_) {
+      throw std::logic_error("Attached configuration images are read-only.");
+    }
+  }
+
+  bool inifile::erase(section_t& sec, const std::string& key) {
+    const std::size_t i = sec.entries.find(key);
+
+    if(i == kv_t::npos) {
+      return false;
+    }
+
+    this->fingerprint_ -= private_::hash_section(sec.id, sec.hash);
+    sec.hash -= private_::hash_entry(key, sec.entries.value(i));
+    sec.entries.erase(i);
+    this->fingerprint_ += private_::hash_section(sec.id, sec.hash);
+    ++this->version_;
+    return true;
+  }
+
+  std::uint64_t inifile::version() const {
+    return this->version_;
+  }
+
+  const load_stats& inifile::stats() const {
+    return this->stats_;
+  }
+
+  digest inifile::fingerprint() const {
+    return this->fingerprint_;
+  }
+
+  digest inifile::fingerprint(const std::string& section) const {
+    const section_ref sec = this->find_section(section);
+
+    if(!sec) {
+      throw unknown_section_error(section);
+    }
+
+    return section_hash(sec);
+  }
+
+  inisection inifile::section(const std::string& section) const {
+    if(!this->find_section(section)) {
+      throw unknown_section_error(section);
+    }
+
+    return inisection(section, *this);
+  };
+
+  inifile::section_ref inifile::default_section() const {
+    if(this->image_) {
+      const auto* hdr =
+        reinterpret_cast<const private_::image_header*>(this->image_);
+      return { nullptr, reinterpret_cast<const private_::image_section*>(
+                          this->image_ + hdr->sections), this->image_ };
+    }
+
+    return { &this->defaultsection_, nullptr, nullptr };
+  }
+
+  inifile::section_ref inifile::find_section(std::string_view name) const {
+    if(this->image_) {
+      return this->find_image_section(name, private_::image_hash(name));
+    }
+
+    auto it = private_::find(this->sections_, name);
+
+    if(it == this->sections_.end()) {
+      return { nullptr, nullptr, nullptr };
+    }
+
+    return { &it->second, nullptr, nullptr };
+  }
+
+  inifile::section_ref
+  inifile::find_image_section(std::string_view name,
+                              std::uint64_t hash) const {
+    const auto* hdr =
+      reinterpret_cast<const private_::image_header*>(this->image_);
+    const auto* secs = reinterpret_cast<const private_::image_section*>(
+      this->image_ + hdr->sections);
+    const auto* table = reinterpret_cast<const std::uint32_t*>(
+      this->image_ + hdr->table);
+
+    if(hdr->slots == 0) {
+      return { nullptr, nullptr, nullptr };
+    }
+
+    const std::uint32_t mask = hdr->slots - 1;
+    for(std::uint32_t slot = hash & mask; table[slot];
+        slot = (slot + 1) & mask) {
+      const private_::image_section& sec = secs[table[slot]];
+      if(std::string_view(this->image_ + sec.name, sec.name_size) == name) {
+        return { nullptr, &sec, this->image_ };
+      }
+    }
+
+    return { nullptr, nullptr, nullptr };
+  }
+
+  template<typename F>
+  void inifile::for_each_section(F&& f) const {
+    if(this->image_) {
+      const auto* hdr =
+        reinterpret_cast<const private_::image_header*>(this->image_);
+      const auto* secs = reinterpret_cast<const private_::image_section*>(
+        this->image_ + hdr->sections);
+
+      for(std::uint32_t i = 1; i <= hdr->nsections; ++i) {
+        f(std::string_view(this->image_ + secs[i].name, secs[i].name_size),
+          section_ref{ nullptr, &secs[i], this->image_ });
+      }
+      return;
+    }
+
+    for(const auto& sec : this->sections_) {
+      f(std::string_view(sec.first),
+        section_ref{ &sec.second, nullptr, nullptr });
+    }
+  }
+
+  std::size_t inifile::section_count() const {
+    if(this->image_) {
+      return reinterpret_cast<const private_::image_header*>(
+        this->image_)->nsections;
+    }
+
+    return this->sections_.size();
+  }
+
+  bool inifile::find_entry(const section_ref& sec, std::string_view key,
+                           std::string_view& value) {
+    if(sec.image) {
+      return find_image_entry(sec, key, private_::image_hash(key), value);
+    }
+
+    const std::size_t i = sec.map->entries.find(key);
+
+    if(i == kv_t::npos) {
+      return false;
+    }
+
+    value = sec.map->entries.value(i);
+    return true;
+  }
+
+  bool inifile::find_image_entry(const section_ref& sec, std::string_view key,
+                                 std::uint64_t hash, std::string_view& value) {
+    if(sec.image->slots == 0) {
+      return false;
+    }
+
+    const auto* entries = reinterpret_cast<const private_::image_entry*>(
+      sec.base + sec.image->entries);
+    const auto* table = reinterpret_cast<const std::uint32_t*>(
+      sec.base + sec.image->table);
+    const std::uint32_t mask = sec.image->slots - 1;
+
+    for(std::uint32_t slot = hash & mask; table[slot];
+        slot = (slot + 1) & mask) {
+      const private_::image_entry& e = entries[table[slot] - 1];
+      if(std::string_view(sec.base + e.key, e.key_size) == key) {
+        value = std::string_view(sec.base + e.value, e.value_size);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Probes the keys of one section in table order rather than in the
+  // caller's order, so consecutive probes hit neighbouring slots, and
+  // prefetches the image slots while hashing.
+  template<typename Key, typename Found>
+  void inifile::probe(const section_ref& sec, std::size_t n, Key&& key,
+                      Found&& found) {
+    struct item
+    {
+      std::size_t slot;
+      std::uint64_t hash;
+      std::size_t index;
+
+      bool operator<(const item& other) const { return slot < other.slot; }
+    };
+
+    std::vector<item> order(n);
+    std::string_view value;
+
+    if(sec.image) {
+      if(sec.image->slots == 0) {
+        return;
+      }
+
+      const auto* table = reinterpret_cast<const std::uint32_t*>(
+        sec.base + sec.image->table);
+
+      for(std::size_t i = 0; i < n; ++i) {
+        const std::uint64_t h = private_::image_hash(key(i));
+        order[i] = { h & (sec.image->slots - 1), h, i };
+        private_::prefetch(table + order[i].slot);
+      }
+
+      std::sort(order.begin(), order.end());
+
+      for(const item& it : order) {
+        if(find_image_entry(sec, key(it.index), it.hash, value)) {
+          found(it.index, value);
+        }
+      }
+      return;
+    }
+
+    const kv_t& entries = sec.map->entries;
+
+    for(std::size_t i = 0; i < n; ++i) {
+      const std::uint32_t h = kv_t::hash(key(i));
+      order[i] = { entries.slot(h), h, i };
+      entries.prefetch(h);
+    }
+
+    std::sort(order.begin(), order.end());
+
+    for(const item& it : order) {
+      const std::size_t e = entries.find(key(it.index), it.hash);
+      if(e != kv_t::npos) {
+        found(it.index, entries.value(e));
+      }
+    }
+  }
+
+  std::vector<std::optional<std::string_view>>
+  inifile::lookup(const std::string& section,
+                  const std::vector<std::string_view>& keys) const {
+    const section_ref sec = this->find_section(section);
+
+    if(!sec) {
+      throw unknown_section_error(section);
+    }
+
+    std::vector<std::optional<std::string_view>> values(keys.size());
+    probe(sec, keys.size(),
+          [&](std::size_t i) { return keys[i]; },
+          [&](std::size_t i, std::string_view value) { values[i] = value; });
+
+    return values;
+  }
+
+  std::vector<std::optional<std::string_view>>
+  inifile::lookup(const std::vector<key_ref>& keys) const {
+    // lookups in flight between prefetching and resolving
+    const std::size_t window = 16;
+
+    struct item
+    {
+      std::uint64_t hash;
+      section_ref sec;
+    };
+
+    std::vector<std::optional<std::string_view>> values(keys.size());
+    item items[window];
+    private_::batch_finder finder;
+    const auto* hdr =
+      reinterpret_cast<const private_::image_header*>(this->image_);
+
+    for(std::size_t begin = 0; begin < keys.size(); begin += window) {
+      const std::size_t n = std::min(window, keys.size() - begin);
+      const key_ref* k = keys.data() + begin;
+
+      // hash the section names and prefetch their slots
+      for(std::size_t i = 0; i < n; ++i) {
+        if(k[i].default_section) {
+          continue;
+        }
+        if(!this->image_) {
+          items[i].hash = this->sections_.hash_function()(k[i].section);
+          private_::prefetch_bucket(this->sections_, items[i].hash);
+        }
+        else if(hdr->slots) {
+          items[i].hash = private_::image_hash(k[i].section);
+          private_::prefetch(this->image_ + hdr->table + sizeof(std::uint32_t) *
+                             (items[i].hash & (hdr->slots - 1)));
+        }
+      }
+
+      // resolve the sections, hash the keys and prefetch their slots
+      for(std::size_t i = 0; i < n; ++i) {
+        section_ref& sec = items[i].sec;
+
+        if(k[i].default_section) {
+          sec = this->default_section();
+        }
+        else if(this->image_) {
+          sec = this->find_image_section(k[i].section, items[i].hash);
+        }
+        else {
+          auto it = finder.find(this->sections_, k[i].section);
+          sec = (it == this->sections_.end()) ? section_ref()
+                : section_ref{ &it->second, nullptr, nullptr };
+        }
+
+        if(sec.map) {
+          items[i].hash = kv_t::hash(k[i].key);
+          sec.map->entries.prefetch(items[i].hash);
+        }
+        else if(sec.image && sec.image->slots) {
+          items[i].hash = private_::image_hash(k[i].key);
+          private_::prefetch(sec.base + sec.image->table +
+                             sizeof(std::uint32_t) *
+                             (items[i].hash & (sec.image->slots - 1)));
+        }
+      }
+
+      // resolve the entries
+      for(std::size_t i = 0; i < n; ++i) {
+        const section_ref& sec = items[i].sec;
+        std::string_view value;
+
+        if(sec.map) {
+          const std::size_t e = sec.map->entries.find(k[i].key,
+                                                      items[i].hash);
+          if(e != kv_t::npos) {
+            values[begin + i] = sec.map->entries.value(e);
+          }
+        }
+        else if(sec.image &&
+                find_image_entry(sec, k[i].key, items[i].hash, value)) {
+          values[begin + i] = value;
+        }
+      }
+    }
+
+    return values;
+  }
+
+  std::size_t inifile::getvals(const std::string& section, field* fields,
+                               std::size_t n) const {
+    std::size_t nfound = 0;
+
+    for(std::size_t i = 0; i < n; ++i) {
+      fields[i].found = false;
+    }
+
+    const section_ref sec = this->find_section(section);
+
+    if(sec) {
+      probe(sec, n,
+            [&](std::size_t i) { return fields[i].key; },
+            [&](std::size_t i, std::string_view value) {
+              if(fields[i].convert(value, fields[i].target)) {
+                fields[i].found = true;
+                ++nfound;
+              }
+            });
+    }
+
+    return nfound;
+  }
+
+  template<typename T>
+  field bind(std::string_view key, T& target) {
+    return { key, &target, &private_::convert<T>, false };
+  }
+
+  template<typename T, typename D>
+  field bind(std::string_view key, T& target, D&& def) {
+    target = std::forward<D>(def);
+    return bind(key, target);
+  }
+
+  template<typename F>
+  void inifile::for_each_entry(const section_ref& sec, F&& f) {
+    if(sec.image) {
+      const auto* entries = reinterpret_cast<const private_::image_entry*>(
+        sec.base + sec.image->entries);
+
+      for(std::uint32_t i = 0; i < sec.image->nentries; ++i) {
+        f(std::string_view(sec.base + entries[i].key, entries[i].key_size),
+          std::string_view(sec.base + entries[i].value,
+                           entries[i].value_size));
+      }
+      return;
+    }
+
+    for(std::size_t i = 0; i < sec.map->entries.size(); ++i) {
+      f(sec.map->entries.key(i), sec.map->entries.value(i));
+    }
+  }
+
+  std::size_t inifile::section_size(const section_ref& sec) {
+    return sec.image ? sec.image->nentries : sec.map->entries.size();
+  }
+
+  digest inifile::section_hash(const section_ref& sec) {
+    if(sec.image) {
+      return { sec.image->hash_lo, sec.image->hash_hi };
+    }
+
+    return sec.map->hash;
+  }
+
+  inifile::image_layout inifile::layout_image() const {
+    auto align = [](std::size_t n) { return (n + 7) & ~std::size_t(7); };
+    // power of two with a load factor of at most one half
+    auto slots = [](std::size_t n) {
+      std::size_t s = n ? 2 : 0;
+      while(s < 2 * n) {
+        s *= 2;
+      }
+      return s;
+    };
+
+    std::size_t nsections = 0;
+    std::size_t nentries = section_size(this->default_section());
+    std::size_t tables = slots(nentries);
+    std::size_t strings = 0;
+
+    for_each_entry(this->default_section(),
+                   [&](std::string_view key, std::string_view value) {
+                     strings += key.size() + value.size();
+                   });
+    this->for_each_section([&](std::string_view name, const section_ref& sec) {
+      ++nsections;
+      nentries += section_size(sec);
+      tables += slots(section_size(sec));
+      strings += name.size();
+      for_each_entry(sec, [&](std::string_view key, std::string_view value) {
+        strings += key.size() + value.size();
+      });
+    });
+
+    image_layout lay;
+    lay.sections = align(sizeof(private_::image_header));
+    lay.table = align(lay.sections +
+                      (nsections + 1) * sizeof(private_::image_section));
+    lay.slots = slots(nsections);
+    lay.entries = align(lay.table + lay.slots * sizeof(std::uint32_t));
+    lay.tables = align(lay.entries + nentries * sizeof(private_::image_entry));
+    lay.strings = lay.tables + tables * sizeof(std::uint32_t);
+    lay.size = align(lay.strings + strings);
+
+    if(lay.size > UINT32_MAX) {
+      throw std::length_error("Configuration image exceeds 4 GiB.");
+    }
+
+    return lay;
+  }
+
+  std::size_t inifile::image_size() const {
+    return this->layout_image().size;
+  }
+
+  void inifile::write_image(void* out) const {
+    const image_layout lay = this->layout_image();
+    char* base = static_cast<char*>(out);
+    std::uint32_t entries = lay.entries;
+    std::uint32_t tables = lay.tables;
+    std::uint32_t strings = lay.strings;
+
+    // unused slots and padding must read as zero
+    std::memset(base, 0, lay.size);
+
+    auto put = [&](std::string_view s) {
+      std::copy(s.begin(), s.end(), base + strings);
+      strings += s.size();
+      return static_cast<std::uint32_t>(strings - s.size());
+    };
+
+    auto* secs = reinterpret_cast<private_::image_section*>(
+      base + lay.sections);
+    std::uint32_t nsections = 0;
+
+    auto write_section = [&](std::string_view name, const section_ref& sec) {
+      private_::image_section& rec = secs[nsections++];
+      const std::uint32_t n = section_size(sec);
+      const digest hash = section_hash(sec);
+
+      rec.name = put(name);
+      rec.name_size = name.size();
+      rec.entries = entries;
+      rec.nentries = n;
+      rec.table = tables;
+      rec.slots = 0;
+      rec.hash_lo = hash.lo;
+      rec.hash_hi = hash.hi;
+
+      while(rec.slots < 2 * n) {
+        rec.slots = rec.slots ? rec.slots * 2 : 2;
+      }
+
+      auto* recs = reinterpret_cast<private_::image_entry*>(base + entries);
+      auto* table = reinterpret_cast<std::uint32_t*>(base + tables);
+      std::uint32_t i = 0;
+
+      for_each_entry(sec, [&](std::string_view key, std::string_view value) {
+        recs[i].key = put(key);
+        recs[i].key_size = key.size();
+        recs[i].value = put(value);
+        recs[i].value_size = value.size();
+
+        std::uint32_t slot = private_::image_hash(key) & (rec.slots - 1);
+        while(table[slot]) {
+          slot = (slot + 1) & (rec.slots - 1);
+        }
+        table[slot] = ++i;
+      });
+
+      entries += n * sizeof(private_::image_entry);
+      tables += rec.slots * sizeof(std::uint32_t);
+    };
+
+    write_section(std::string_view(), this->default_section());
+    this->for_each_section(write_section);
+
+    auto* table = reinterpret_cast<std::uint32_t*>(base + lay.table);
+    for(std::uint32_t i = 1; i < nsections; ++i) {
+      std::uint32_t slot = private_::image_hash(
+        std::string_view(base + secs[i].name, secs[i].name_size)) &
+        (lay.slots - 1);
+      while(table[slot]) {
+        slot = (slot + 1) & (lay.slots - 1);
+      }
+      table[slot] = i;
+    }
+
+    auto* hdr = reinterpret_cast<private_::image_header*>(base);
+    hdr->byte_order = private_::image_byte_order;
+    hdr->nsections = nsections - 1;
+    hdr->size = lay.size;
+    hdr->fingerprint_lo = this->fingerprint_.lo;
+    hdr->fingerprint_hi = this->fingerprint_.hi;
+    hdr->sections = lay.sections;
+    hdr->table = lay.table;
+    hdr->slots = lay.slots;
+
+    // readers in other processes may look at the image while it is
+    // written, they accept it only once the magic is in place
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(hdr->magic, private_::image_magic, sizeof(hdr->magic));
+  }
+
+  inifile inifile::attach(const void* image, std::size_t size,
+                          std::shared_ptr<const void> owner) {
+    const char* base = static_cast<const char*>(image);
+    const auto* hdr = static_cast<const private_::image_header*>(image);
+
+    if(reinterpret_cast<std::uintptr_t>(image) % 8 != 0) {
+      throw std::invalid_argument("Configuration images must be 8-byte "
+                                  "aligned.");
+    }
+
+    auto invalid = []() {
+      return syntax_error("Invalid configuration image.");
+    };
+
+    if(size < sizeof(private_::image_header) ||
+       std::memcmp(hdr->magic, private_::image_magic,
+                   sizeof(hdr->magic)) != 0) {
+      throw invalid();
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(hdr->byte_order != private_::image_byte_order) {
+      throw syntax_error("Configuration image of different byte order.");
+    }
+
+    // check that everything lies within the image and that all hash
+    // tables are at most half full with in-range indices, so that no
+    // lookup can read outside of the image or probe forever
+    auto fits = [&](std::uint64_t offset, std::uint64_t count,
+                    std::uint64_t width) {
+      return offset % std::min<std::uint64_t>(width, 4) == 0 &&
+             offset <= hdr->size && count <= (hdr->size - offset) / width;
+    };
+
+    auto table_ok = [&](std::uint32_t offset, std::uint32_t slots,
+                        std::uint32_t n) {
+      if((slots & (slots - 1)) != 0 || slots < 2 * std::uint64_t(n) ||
+         !fits(offset, slots, sizeof(std::uint32_t))) {
+        return false;
+      }
+
+      const auto* table =
+        reinterpret_cast<const std::uint32_t*>(base + offset);
+      std::uint32_t used = 0;
+
+      for(std::uint32_t slot = 0; slot < slots; ++slot) {
+        if(table[slot] > n || (table[slot] && ++used > n)) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    if(hdr->size > size ||
+       hdr->sections % 8 != 0 ||
+       !fits(hdr->sections, std::uint64_t(hdr->nsections) + 1,
+             sizeof(private_::image_section)) ||
+       !table_ok(hdr->table, hdr->slots, hdr->nsections)) {
+      throw invalid();
+    }
+
+    const auto* secs =
+      reinterpret_cast<const private_::image_section*>(base + hdr->sections);
+    for(std::uint32_t i = 0; i <= hdr->nsections; ++i) {
+      if(!fits(secs[i].entries, secs[i].nentries,
+               sizeof(private_::image_entry)) ||
+         !table_ok(secs[i].table, secs[i].slots, secs[i].nentries) ||
+         !fits(secs[i].name, secs[i].name_size, 1)) {
+        throw invalid();
+      }
+
+      const auto* entries = reinterpret_cast<const private_::image_entry*>(
+        base + secs[i].entries);
+      for(std::uint32_t k = 0; k < secs[i].nentries; ++k) {
+        if(!fits(entries[k].key, entries[k].key_size, 1) ||
+           !fits(entries[k].value, entries[k].value_size, 1)) {
+          throw invalid();
+        }
+      }
+    }
+
+    inifile ini;
+    ini.image_ = base;
+    ini.image_owner_ = std::move(owner);
+    ini.fingerprint_ = { hdr->fingerprint_lo, hdr->fingerprint_hi };
+    return ini;
+  }
+
+#ifdef INIPP_WITH_SHM
+  void shm_publish(const std::string& name, const inifile& cfg) {
+    const std::size_t size = cfg.image_size();
+    const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if(fd < 0) {
+      throw std::system_error(errno, std::generic_category(),
+                              "shm_open " + name);
+    }
+
+    void* image = MAP_FAILED;
+    int err = 0;
+
+    if(::ftruncate(fd, size) != 0) {
+      err = errno;
+    }
+    else {
+      image = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(image == MAP_FAILED) {
+        err = errno;
+      }
+    }
+    ::close(fd);
+
+    if(err) {
+      ::shm_unlink(name.c_str());
+      throw std::system_error(err, std::generic_category(),
+                              "shm_publish " + name);
+    }
+
+    cfg.write_image(image);
+    ::munmap(image, size);
+  }
+
+  inifile shm_attach(const std::string& name) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+
+    if(fd < 0) {
+      throw std::system_error(errno, std::generic_category(),
+                              "shm_open " + name);
+    }
+
+    struct stat st;
+    void* image = MAP_FAILED;
+    int err = 0;
+
+    if(::fstat(fd, &st) != 0) {
+      err = errno;
+    }
+    else if(st.st_size > 0) {
+      image = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(image == MAP_FAILED) {
+        err = errno;
+      }
+    }
+    ::close(fd);
+
+    if(err) {
+      throw std::system_error(err, std::generic_category(),
+                              "shm_attach " + name);
+    }
+    if(image == MAP_FAILED) {
+      throw syntax_error("Invalid configuration image.");
+    }
+
+    const std::size_t size = st.st_size;
+    std::shared_ptr<const void> owner(image, [size](const void* p) {
+      ::munmap(const_cast<void*>(p), size);
+    });
+
+    return inifile::attach(image, size, std::move(owner));
+  }
+
+  bool shm_remove(const std::string& name) {
+    return ::shm_unlink(name.c_str()) == 0;
+  }
+#endif
+
+  void inifile::diff_section(const section_ref& from, const section_ref& to,
+                             bool default_section, std::string_view name,
+                             std::vector<change>& changes) {
+    auto str = [](std::string_view s) { return std::string(s); };
+
+    // equal hashes over equally sized sections mean equal contents
+    if(from && to && section_hash(from) == section_hash(to) &&
+       section_size(from) == section_size(to)) {
+      return;
+    }
+
+    if(from) {
+      for_each_entry(from, [&](std::string_view key, std::string_view old) {
+        std::string_view value;
+
+        if(!to || !find_entry(to, key, value)) {
+          changes.push_back({ change::removed, default_section, str(name),
+                              str(key), str(old), std::string() });
+        }
+        else if(value != old) {
+          changes.push_back({ change::changed, default_section, str(name),
+                              str(key), str(old), str(value) });
+        }
+      });
+    }
+
+    if(to) {
+      for_each_entry(to, [&](std::string_view key, std::string_view value) {
+        std::string_view old;
+
+        if(!from || !find_entry(from, key, old)) {
+          changes.push_back({ change::added, default_section, str(name),
+                              str(key), std::string(), str(value) });
+        }
+      });
+    }
+  }
+
+  std::vector<change> diff(const inifile& from, const inifile& to) {
+    std::vector<change> changes;
+
+    inifile::diff_section(from.default_section(), to.default_section(), true,
+                          std::string_view(), changes);
+
+    from.for_each_section([&](std::string_view name,
+                              const inifile::section_ref& sec) {
+      inifile::diff_section(sec, to.find_section(name), false, name, changes);
+    });
+
+    to.for_each_section([&](std::string_view name,
+                            const inifile::section_ref& sec) {
+      if(!from.find_section(name)) {
+        inifile::diff_section(inifile::section_ref(), sec, false, name,
+                              changes);
+      }
+    });
+
+    // hash order is meaningless to whoever reads the result
+    std::sort(changes.begin(), changes.end(),
+              [](const change& a, const change& b) {
+                if(a.default_section != b.default_section) {
+                  return a.default_section;
+                }
+                return std::tie(a.section, a.key) < std::tie(b.section, b.key);
+              });
+
+    return changes;
+  }
+
+  reloadable::reloadable(std::shared_ptr<const inifile> initial)
+    : id_(private_::next_holder_id()),
+      epoch_(1),
+      current_(std::move(initial)),
+      next_sub_(1),
+      stopping_(false) {
+    if(!this->current_) {
+      throw std::invalid_argument("A reloadable needs a configuration.");
+    }
+  }
+
+  reloadable::reloadable(inifile&& initial)
+    : reloadable(std::make_shared<const inifile>(std::move(initial))) {
+    /* empty */
+  }
+
+  reloadable::~reloadable() {
+    private_::holder_generation().fetch_add(1, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> lock(this->subs_mutex_);
+      this->stopping_ = true;
+    }
+    this->subs_cv_.notify_all();
+
+    if(this->dispatcher_.joinable()) {
+      this->dispatcher_.join();
+    }
+  }
+
+  void reloadable::publish(std::shared_ptr<const inifile> cfg) {
+    if(!cfg) {
+      throw std::invalid_argument("A reloadable needs a configuration.");
+    }
+
+    std::lock_guard<std::mutex> publishing(this->publish_mutex_);
+    std::shared_ptr<const inifile> old;
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      old = this->current_;
+      this->current_ = cfg;
+      this->epoch_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    this->notify(*old, *cfg);
+    // the old snapshot may be destroyed here, outside of the lock
+  }
+
+  void reloadable::publish(inifile&& cfg) {
+    this->publish(std::make_shared<const inifile>(std::move(cfg)));
+  }
+
+  void reloadable::reload(std::istream& in) {
+    // the current version is the best guess of the new one's size
+    const std::shared_ptr<const inifile> cur = this->snapshot();
+    parse_options options;
+    options.size_hint = cur.get();
+    this->publish(inifile(in, options));
+  }
+
+  std::uint64_t reloadable::subscribe(const std::string& section,
+                                      const std::string& key, callback cb) {
+    return this->subscribe(topic_t(false, false, section, key), std::move(cb));
+  }
+
+  std::uint64_t reloadable::subscribe(const std::string& section,
+                                      callback cb) {
+    return this->subscribe(topic_t(false, true, section, std::string()),
+                           std::move(cb));
+  }
+
+  std::uint64_t reloadable::subscribe_default(const std::string& key,
+                                              callback cb) {
+    return this->subscribe(topic_t(true, false, std::string(), key),
+                           std::move(cb));
+  }
+
+  std::uint64_t reloadable::subscribe(topic_t topic, callback cb) {
+    std::lock_guard<std::mutex> lock(this->subs_mutex_);
+    std::uint64_t id = this->next_sub_++;
+
+    this->topics_.emplace(std::move(topic), id);
+    this->callbacks_.emplace(id, std::move(cb));
+
+    if(!this->dispatcher_.joinable()) {
+      this->dispatcher_ = std::thread(&reloadable::dispatch, this);
+    }
+
+    return id;
+  }
+
+  void reloadable::unsubscribe(std::uint64_t id) {
+    std::lock_guard<std::mutex> lock(this->subs_mutex_);
+
+    for(auto it = this->topics_.begin(); it != this->topics_.end(); ) {
+      it = (it->second == id) ? this->topics_.erase(it) : std::next(it);
+    }
+    this->callbacks_.erase(id);
+  }
+
+  void reloadable::notify(const inifile& from, const inifile& to) {
+    {
+      std::lock_guard<std::mutex> lock(this->subs_mutex_);
+      if(this->topics_.empty()) {
+        return;
+      }
+    }
+
+    // diff outside of the lock, subscribing must not wait for it
+    std::vector<change> changes = diff(from, to);
+    std::map<std::uint64_t, std::vector<change>> batches;
+
+    std::lock_guard<std::mutex> lock(this->subs_mutex_);
+
+    for(const change& c : changes) {
+      auto keys = this->topics_.equal_range(
+        topic_t(c.default_section, false, c.section, c.key));
+      auto sections = this->topics_.equal_range(
+        topic_t(c.default_section, true, c.section, std::string()));
+
+      for(auto it = keys.first; it != keys.second; ++it) {
+        batches[it->second].push_back(c);
+      }
+      for(auto it = sections.first; it != sections.second; ++it) {
+        batches[it->second].push_back(c);
+      }
+    }
+
+    for(auto& batch : batches) {
+      this->queue_.emplace_back(batch.first, std::move(batch.second));
+    }
+
+    if(!batches.empty()) {
+      this->subs_cv_.notify_one();
+    }
+  }
+
+  void reloadable::dispatch() {
+    std::unique_lock<std::mutex> lock(this->subs_mutex_);
+
+    while(true) {
+      this->subs_cv_.wait(lock, [this]() {
+        return this->stopping_ || !this->queue_.empty();
+      });
+
+      if(this->queue_.empty()) {
+        return;
+      }
+
+      batch_t batch = std::move(this->queue_.front());
+      this->queue_.pop_front();
+
+      auto it = this->callbacks_.find(batch.first);
+      if(it == this->callbacks_.end()) {
+        continue;
+      }
+
+      // copy, the subscription may be cancelled while the callback runs
+      callback cb = it->second;
+
+      lock.unlock();
+      try {
+        cb(batch.second);
+      }
+      catch(...) {
+        // there is no one to rethrow to on this thread
+      }
+      lock.lock();
+    }
+  }
+
+  const inifile& reloadable::current() const {
+    private_::snapshot_cache& cache = private_::thread_snapshots();
+    private_::snapshot_slot* slots = cache.slots;
+    const std::uint64_t generation =
+      private_::holder_generation().load(std::memory_order_relaxed);
+
+    // some holder was destroyed: release the snapshots of all others,
+    // the live ones are fetched again on their next current()
+    if(cache.generation != generation) {
+      cache.generation = generation;
+      for(std::size_t idx = 0; idx < private_::snapshot_slots; ++idx) {
+        if(slots[idx].holder != this->id_) {
+          slots[idx] = private_::snapshot_slot();
+        }
+      }
+    }
+
+    for(std::size_t idx = 0; idx < private_::snapshot_slots; ++idx) {
+      if(slots[idx].holder == this->id_) {
+        // Relaxed is enough: a stale epoch only delays the switch to a
+        // new snapshot, and refresh() synchronizes through the mutex.
+        if(slots[idx].epoch == this->epoch_.load(std::memory_order_relaxed)) {
+          return *slots[idx].cfg;
+        }
+        return this->refresh(slots[idx]);
+      }
+    }
+
+    // not cached yet: evict the oldest slot
+    std::move_backward(slots, slots + private_::snapshot_slots - 1,
+                       slots + private_::snapshot_slots);
+    slots[0].holder = this->id_;
+    return this->refresh(slots[0]);
+  }
+
+  const inifile& reloadable::refresh(private_::snapshot_slot& slot) const {
+    std::shared_ptr<const inifile> old = std::move(slot.cfg);
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      slot.epoch = this->epoch_.load(std::memory_order_relaxed);
+      slot.cfg = this->current_;
+    }
+
+    return *slot.cfg;
+  }
+
+  std::shared_ptr<const inifile> reloadable::snapshot() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->current_;
+  }
+
+  std::uint64_t reloadable::epoch() const {
+    return this->epoch_.load(std::memory_order_relaxed);
+  }
+
+  inline private_::snapshot_cache& private_::thread_snapshots() {
+    static thread_local snapshot_cache cache;
+    return cache;
+  }
+
+  inline std::atomic<std::uint64_t>& private_::holder_generation() {
+    static std::atomic<std::uint64_t> generation(0);
+    return generation;
+  }
+
+  inline std::uint64_t private_::next_holder_id() {
+    static std::atomic<std::uint64_t> next(1);
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  inisection::inisection(const std::string& section, const inifile& ini)
+    : _section(section),
+      _ini(ini) {
+    /* empty */
+  }
+
+  inline std::string inisection::name() const {
+    return this->_section;
+  }
+
+  inline std::string inisection::get(const std::string& key) const {
+    return this->_ini.get(this->_section, key);
+  }
+
+  inline std::string inisection::dget(const std::string& key,
+                                      const std::string& default_val) const {
+    return this->_ini.dget(this->_section, key, default_val);
+  }
+
+  decompress_streambuf::decompress_streambuf(std::streambuf* source,
+                                             std::size_t blocksize)
+    : source_(source),
+      format_(plain),
+      in_(blocksize),
+      inpos_(0),
+      inlen_(0),
+      done_(false),
+      pending_(false) {
+    this->setg(nullptr, nullptr, nullptr);
+    this->fill();
+
+    const unsigned char* magic =
+      reinterpret_cast<const unsigned char*>(this->in_.data());
+
+    if(this->inlen_ >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+      this->format_ = gzip;
+    }
+    else if(this->inlen_ >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+            magic[2] == 0x2f && magic[3] == 0xfd) {
+      this->format_ = zstd;
+    }
+
+    if(this->format_ == gzip) {
+#ifdef INIPP_WITH_ZLIB
+      std::memset(&this->zlib_, 0, sizeof(this->zlib_));
+      if(inflateInit2(&this->zlib_, 15 + 16) != Z_OK) {
+        throw syntax_error("Could not initialize gzip decompression.");
+      }
+#else
+      throw syntax_error("Reading gzip compressed input requires "
+                         "INIPP_WITH_ZLIB.");
+#endif
+    }
+
+    if(this->format_ == zstd) {
+#ifdef INIPP_WITH_ZSTD
+      this->zstd_ = ZSTD_createDStream();
+      if(!this->zstd_ || ZSTD_isError(ZSTD_initDStream(this->zstd_))) {
+        ZSTD_freeDStream(this->zstd_);
+        throw syntax_error("Could not initialize zstd decompression.");
+      }
+#else
+      throw syntax_error("Reading zstd compressed input requires "
+                         "INIPP_WITH_ZSTD.");
+#endif
+    }
+
+    if(this->format_ != plain) {
+      this->out_.resize(blocksize);
+    }
+  }
+
+  decompress_streambuf::~decompress_streambuf() {
+#ifdef INIPP_WITH_ZLIB
+    if(this->format_ == gzip) {
+      inflateEnd(&this->zlib_);
+    }
+#endif
+#ifdef INIPP_WITH_ZSTD
+    if(this->format_ == zstd) {
+      ZSTD_freeDStream(this->zstd_);
+    }
+#endif
+  }
+
+  // Reads the next block of raw input, returns false at the end.
+  bool decompress_streambuf::fill() {
+    std::streamsize n = this->source_->sgetn(this->in_.data(),
+                                             this->in_.size());
+
+    this->inpos_ = 0;
+    this->inlen_ = n > 0 ? static_cast<std::size_t>(n) : 0;
+    return this->inlen_ > 0;
+  }
+
+  decompress_streambuf::int_type decompress_streambuf::underflow() {
+    if(this->gptr() < this->egptr()) {
+      return traits_type::to_int_type(*this->gptr());
+    }
+
+    if(this->format_ == plain) {
+      // the first block was read by the constructor already
+      if(this->inpos_ == this->inlen_ && !this->fill()) {
+        return traits_type::eof();
+      }
+
+      this->setg(this->in_.data(), this->in_.data(),
+                 this->in_.data() + this->inlen_);
+      this->inpos_ = this->inlen_;
+      return traits_type::to_int_type(*this->gptr());
+    }
+
+    std::size_t produced = 0;
+
+    while(produced == 0 && !this->done_) {
+      if(this->inpos_ == this->inlen_ && !this->fill()) {
+        if(this->pending_) {
+          throw syntax_error("The compressed input is truncated.");
+        }
+        this->done_ = true;
+        break;
+      }
+
+#ifdef INIPP_WITH_ZLIB
+      if(this->format_ == gzip) {
+        this->zlib_.next_in =
+          reinterpret_cast<Bytef*>(this->in_.data() + this->inpos_);
+        this->zlib_.avail_in = static_cast<uInt>(this->inlen_ - this->inpos_);
+        this->zlib_.next_out = reinterpret_cast<Bytef*>(this->out_.data());
+        this->zlib_.avail_out = static_cast<uInt>(this->out_.size());
+
+        int rc = inflate(&this->zlib_, Z_NO_FLUSH);
+
+        if(rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+          throw syntax_error("The gzip compressed input is corrupt.");
+        }
+
+        this->inpos_ = this->inlen_ - this->zlib_.avail_in;
+        produced = this->out_.size() - this->zlib_.avail_out;
+        this->pending_ = (rc != Z_STREAM_END);
+
+        // concatenated members, as written by pigz or cat
+        if(rc == Z_STREAM_END) {
+          inflateReset(&this->zlib_);
+        }
+      }
+#endif
+#ifdef INIPP_WITH_ZSTD
+      if(this->format_ == zstd) {
+        ZSTD_inBuffer input = { this->in_.data() + this->inpos_,
+                                this->inlen_ - this->inpos_, 0 };
+        ZSTD_outBuffer output = { this->out_.data(), this->out_.size(), 0 };
+        std::size_t rc = ZSTD_decompressStream(this->zstd_, &output, &input);
+
+        if(ZSTD_isError(rc)) {
+          throw syntax_error("The zstd compressed input is corrupt.");
+        }
+
+        this->inpos_ += input.pos;
+        produced = output.pos;
+        this->pending_ = (rc != 0);
+      }
+#endif
+    }
+
+    if(produced == 0) {
+      return traits_type::eof();
+    }
+
+    this->setg(this->out_.data(), this->out_.data(),
+               this->out_.data() + produced);
+    return traits_type::to_int_type(*this->gptr());
+  }
+
+  decompressing_istream::decompressing_istream(std::istream& source,
+                                               std::size_t blocksize)
+    : std::istream(nullptr),
+      buf_(source.rdbuf(), blocksize) {
+    this->init(&this->buf_);
+    // let decompression errors escape from std::getline and friends
+    this->exceptions(std::ios::badbit);
+  }
+
+  inidocument::inidocument(std::istream& in)
+    : nlines_(0) {
+    std::streambuf* source = in.rdbuf();
+    std::size_t size = 0;
+
+    // read straight into the buffer, sized up front for seekable streams
+    if(source) {
+      const std::streamoff here =
+        source->pubseekoff(0, std::ios::cur, std::ios::in);
+      const std::streamoff end = (here >= 0)
+        ? std::streamoff(source->pubseekoff(0, std::ios::end, std::ios::in))
+        : here;
+
+      if(end >= 0) {
+        source->pubseekpos(here, std::ios::in);
+        this->buffer_.resize(end - here + 1);
+      }
+    }
+
+    while(source) {
+      if(size == this->buffer_.size()) {
+        this->buffer_.resize(std::max<std::size_t>(2 * size, 1 << 12));
+      }
+
+      const std::streamsize n = source->sgetn(&this->buffer_[size],
+                                              this->buffer_.size() - size);
+      if(n <= 0) {
+        break;
+      }
+      size += static_cast<std::size_t>(n);
+    }
+
+    this->buffer_.resize(size);
+    this->parse();
+  }
+
+  inidocument::inidocument(std::string buffer)
+    : buffer_(std::move(buffer)),
+      nlines_(0) {
+    this->parse();
+  }
+
+  void inidocument::parse() {
+    section_t* cursec = &this->defaultsection_;
+    std::size_t lastheader = npos;
+    std::size_t pos = 0;
+
+    this->defaultsection_.anchor = npos;
+    this->newline_ = "\n";
+
+    const char* data = this->buffer_.data();
+    const char* end = data + this->buffer_.size();
+
+    while(pos < this->buffer_.size()) {
+      const char* eol = private_::find_line_break(data + pos, end);
+      std::size_t next = eol ? eol - data + 1 : this->buffer_.size();
+      std::size_t idx = this->lines_.size();
+
+      if(eol && *eol == '\r' && next < this->buffer_.size() &&
+         data[next] == '\n') {
+        ++next;
+      }
+
+      // inserted lines use the line break of the first line
+      if(idx == 0 && eol) {
+        this->newline_.assign(eol, data + next);
+      }
+
+      std::string_view line(data + pos, next - pos);
+
+      if(idx == 0) {
+        line = private_::skip_bom(line);
+      }
+
+      const private_::line_tokens tok = private_::tokenize(line);
+      line_t rec = { pos, npos, npos, npos, state_t::original };
+
+      if(tok.kind == private_::line_tokens::section) {
+        // default entries go in front of the first header unless
+        // there already are some
+        if(lastheader == npos && this->defaultsection_.anchor == npos) {
+          this->defaultsection_.anchor = idx;
+        }
+        cursec = &this->sections_[std::string(tok.key)];
+        cursec->anchor = idx + 1;
+        lastheader = idx;
+      }
+      else if(tok.kind == private_::line_tokens::entry) {
+        std::string key(tok.key);
+        auto it = cursec->entries.find(key);
+
+        rec.vbegin = tok.value.data() - this->buffer_.data();
+        rec.vend = rec.vbegin + tok.value.size();
+
+        if(it != cursec->entries.end()) {
+          rec.shadowed = it->second;
+          it->second = idx;
+        }
+        else {
+          cursec->entries.emplace(std::move(key), idx);
+        }
+        cursec->anchor = idx + 1;
+      }
+      else if(tok.kind == private_::line_tokens::bad_section) {
+        throw syntax_error("The section '" + std::string(tok.text) +
+                           "' is missing a closing bracket.");
+      }
+      else if(tok.kind == private_::line_tokens::bad_line) {
+        throw syntax_error("The line '" + std::string(tok.text) +
+                           "' is invalid.");
+      }
+
+      this->lines_.push_back(rec);
+      pos = next;
+    }
+
+    this->nlines_ = this->lines_.size();
+
+    // without any headers or default entries, add to the end
+    if(this->defaultsection_.anchor == npos) {
+      this->defaultsection_.anchor = this->nlines_;
+    }
+  }
+
+  std::string inidocument::get(const std::string& section,
+                               const std::string& key) const {
+    auto sec = this->sections_.find(section);
+
+    if(sec == this->sections_.end()) {
+      throw unknown_section_error(section);
+    }
+
+    auto it = sec->second.entries.find(key);
+
+    if(it == sec->second.entries.end()) {
+      throw unknown_entry_error(key, section);
+    }
+
+    const line_t& line = this->lines_[it->second];
+
+    if(line.state == state_t::original) {
+      return this->buffer_.substr(line.vbegin, line.vend - line.vbegin);
+    }
+
+    return this->values_.find(it->second)->second;
+  }
+
+  std::string inidocument::get(const std::string& key) const {
+    auto it = this->defaultsection_.entries.find(key);
+
+    if(it == this->defaultsection_.entries.end()) {
+      throw unknown_entry_error(key);
+    }
+
+    const line_t& line = this->lines_[it->second];
+
+    if(line.state == state_t::original) {
+      return this->buffer_.substr(line.vbegin, line.vend - line.vbegin);
+    }
+
+    return this->values_.find(it->second)->second;
+  }
+
+  void inidocument::set(const std::string& section, const std::string& key,
+                        const std::string& value) {
+    private_::check_representable(section, "]\r\n", "section name");
+
+    auto sec = this->sections_.find(section);
+
+    if(sec == this->sections_.end()) {
+      private_::check_representable(key, value);
+
+      // new sections are appended to the end of the document
+      std::size_t header = this->insert(npos, "[" + section + "]");
+      sec = this->sections_.emplace(section, section_t()).first;
+      sec->second.anchor = header + 1;
+      sec->second.header = header;
+    }
+
+    this->set(sec->second, key, value);
+  }
+
+  void inidocument::set(const std::string& key, const std::string& value) {
+    this->set(this->defaultsection_, key, value);
+  }
+
+  void inidocument::set(section_t& sec, const std::string& key,
+                        const std::string& value) {
+    private_::check_representable(key, value);
+
+    auto it = sec.entries.find(key);
+
+    if(it == sec.entries.end()) {
+      std::size_t idx = this->insert(sec.anchor, key + " = ");
+      this->values_[idx] = value;
+      sec.entries.emplace(key, idx);
+      return;
+    }
+
+    line_t& line = this->lines_[it->second];
+
+    if(line.state == state_t::original) {
+      line.state = state_t::replaced;
+    }
+    this->values_[it->second] = value;
+  }
+
+  bool inidocument::erase(const std::string& section, const std::string& key) {
+    auto sec = this->sections_.find(section);
+
+    if(sec == this->sections_.end() || !this->erase(sec->second, key)) {
+      return false;
+    }
+
+    // a section set() added goes away with its last entry, so that
+    // erasing undoes setting
+    if(sec->second.header != npos && sec->second.entries.empty()) {
+      this->lines_[sec->second.header].state = state_t::deleted;
+      this->sections_.erase(sec);
+    }
+
+    return true;
+  }
+
+  bool inidocument::erase(const std::string& key) {
+    return this->erase(this->defaultsection_, key);
+  }
+
+  bool inidocument::erase(section_t& sec, const std::string& key) {
+    auto it = sec.entries.find(key);
+
+    if(it == sec.entries.end()) {
+      return false;
+    }
+
+    // drop shadowed definitions too, or they would resurface on reparse
+    for(std::size_t idx = it->second; idx != npos;
+        idx = this->lines_[idx].shadowed) {
+      this->lines_[idx].state = state_t::deleted;
+      this->values_.erase(idx);
+    }
+
+    sec.entries.erase(it);
+    return true;
+  }
+
+  std::size_t inidocument::insert(std::size_t anchor, std::string text) {
+    std::size_t idx = this->lines_.size();
+
+    this->lines_.push_back({ npos, npos, npos, npos, state_t::replaced });
+    this->texts_.emplace(idx, std::move(text));
+    this->inserts_[anchor].push_back(idx);
+
+    return idx;
+  }
+
+  std::size_t inidocument::line_end(std::size_t idx) const {
+    return (idx + 1 < this->nlines_) ? this->lines_[idx + 1].begin
+                                     : this->buffer_.size();
+  }
+
+  void inidocument::write_inserts(std::ostream& out, std::size_t anchor,
+                                  bool& bol) const {
+    auto it = this->inserts_.find(anchor);
+
+    if(it == this->inserts_.end()) {
+      return;
+    }
+
+    for(std::size_t idx : it->second) {
+      if(this->lines_[idx].state == state_t::deleted) {
+        continue;
+      }
+
+      const std::string& text = this->texts_.find(idx)->second;
+
+      if(!bol) {
+        out << this->newline_;
+      }
+
+      // separate appended sections from whatever precedes them
+      if(text[0] == '[' && anchor == npos && this->nlines_ > 0) {
+        out << this->newline_;
+      }
+
+      out << text;
+      if(this->values_.count(idx)) {
+        out << this->values_.find(idx)->second;
+      }
+      out << this->newline_;
+      bol = true;
+
+      this->write_inserts(out, idx + 1, bol);
+    }
+  }
+
+  void inidocument::write(std::ostream& out) const {
+    // unmodified lines are copied in as few contiguous runs as possible
+    std::size_t run = 0;
+    bool bol = true;
+    auto ins = this->inserts_.begin();
+
+    auto flush = [&](std::size_t end) {
+      if(end > run) {
+        out.write(this->buffer_.data() + run, end - run);
+        bol = (this->buffer_[end - 1] == '\n' ||
+               this->buffer_[end - 1] == '\r');
+      }
+      run = end;
+    };
+
+    for(std::size_t idx = 0; idx < this->nlines_; ++idx) {
+      const line_t& line = this->lines_[idx];
+
+      if(ins != this->inserts_.end() && ins->first == idx) {
+        flush(line.begin);
+        this->write_inserts(out, idx, bol);
+        ++ins;
+      }
+
+      if(line.state == state_t::original) {
+        continue;
+      }
+
+      flush(line.begin);
+      run = this->line_end(idx);
+
+      if(line.state == state_t::deleted) {
+        continue;
+      }
+
+      const std::string& value = this->values_.find(idx)->second;
+      std::size_t vbegin = line.vbegin;
+
+      out.write(this->buffer_.data() + line.begin, vbegin - line.begin);
+      if(vbegin == line.vend && this->buffer_[vbegin - 1] == '=' &&
+         !value.empty()) {
+        out << ' ';
+      }
+      out << value;
+      out.write(this->buffer_.data() + line.vend, run - line.vend);
+      bol = (this->buffer_[run - 1] == '\n' ||
+             this->buffer_[run - 1] == '\r');
+    }
+
+    flush(this->buffer_.size());
+    this->write_inserts(out, this->nlines_, bol);
+    this->write_inserts(out, npos, bol);
+  }
+
+  std::string inidocument::str() const {
+    std::ostringstream out;
+    this->write(out);
+    return out.str();
+  }
+
+  digest& digest::operator+=(const digest& other) {
+    this->lo += other.lo;
+    this->hi += other.hi + (this->lo < other.lo);
+    return *this;
+  }
+
+  digest& digest::operator-=(const digest& other) {
+    this->hi -= other.hi + (this->lo < other.lo);
+    this->lo -= other.lo;
+    return *this;
+  }
+
+  bool digest::operator==(const digest& other) const {
+    return this->lo == other.lo && this->hi == other.hi;
+  }
+
+  bool digest::operator!=(const digest& other) const {
+    return !(*this == other);
+  }
+
+  std::string digest::str() const {
+    static const char hex[] = "0123456789abcdef";
+    std::string out(32, '0');
+
+    for(int i = 0; i < 16; ++i) {
+      out[15 - i] = hex[(this->hi >> (4 * i)) & 0xf];
+      out[31 - i] = hex[(this->lo >> (4 * i)) & 0xf];
+    }
+
+    return out;
+  }
+
+  template<typename Map>
+  inline auto private_::find(Map& map, std::string_view key)
+    -> decltype(map.end()) {
+#if defined(__cpp_lib_generic_unordered_lookup)
+    return map.find(key);
+#else
+    // build the key on the stack, keeping lookups off the config's
+    // resource and (for keys up to 256 bytes) the heap
+    char buf[256];
+    std::pmr::monotonic_buffer_resource scratch(buf, sizeof(buf));
+    return map.find(std::pmr::string(key, &scratch));
+#endif
+  }
+
+  inline void private_::prefetch(const void* p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+  }
+
+  template<typename Map>
+  inline void private_::prefetch_bucket(const Map& map, std::size_t hash) {
+    const std::size_t bucket = hash % map.bucket_count();
+
+    if(map.begin(bucket) != map.end(bucket)) {
+      prefetch(&*map.begin(bucket));
+    }
+  }
+
+  // MurmurHash3 x64 128 (Austin Appleby, public domain) with a 128-bit
+  // seed. Stable across processes and platforms, unlike std::hash, so
+  // results can be compared between hosts. Not collision resistant
+  // against deliberate attacks.
+  inline digest private_::hash128(std::string_view s, digest seed) {
+    const std::uint64_t c1 = 0x87c37b91114253d5ULL;
+    const std::uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    auto rotl = [](std::uint64_t x, int r) {
+      return (x << r) | (x >> (64 - r));
+    };
+    auto fmix = [](std::uint64_t k) {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      k *= 0xc4ceb9fe1a85ec53ULL;
+      return k ^ (k >> 33);
+    };
+    auto load = [](const char* p) {
+      std::uint64_t k;
+      std::memcpy(&k, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      k = __builtin_bswap64(k);
+#endif
+      return k;
+    };
+
+    const char* p = s.data();
+    const std::size_t len = s.size();
+    std::uint64_t h1 = seed.lo;
+    std::uint64_t h2 = seed.hi;
+    std::size_t n = len;
+
+    for(; n >= 16; p += 16, n -= 16) {
+      std::uint64_t k1 = load(p);
+      std::uint64_t k2 = load(p + 8);
+
+      h1 ^= rotl(k1 * c1, 31) * c2;
+      h1 = (rotl(h1, 27) + h2) * 5 + 0x52dce729;
+      h2 ^= rotl(k2 * c2, 33) * c1;
+      h2 = (rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+    }
+
+    std::uint64_t k1 = 0;
+    std::uint64_t k2 = 0;
+
+    for(std::size_t i = n; i > 8; --i) {
+      k2 = (k2 << 8) | static_cast<unsigned char>(p[i - 1]);
+    }
+    for(std::size_t i = std::min<std::size_t>(n, 8); i > 0; --i) {
+      k1 = (k1 << 8) | static_cast<unsigned char>(p[i - 1]);
+    }
+
+    if(n > 8) {
+      h2 ^= rotl(k2 * c2, 33) * c1;
+    }
+    if(n > 0) {
+      h1 ^= rotl(k1 * c1, 31) * c2;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    return { h1, h2 };
+  }
+
+  inline digest private_::hash_entry(std::string_view key,
+                                     std::string_view value) {
+    return hash128(value, hash128(key, { 0, 0 }));
+  }
+
+  // Contribution of a section to the fingerprint of the whole file. Not
+  // additive in the contents, so moving entries between sections shows.
+  inline digest private_::hash_section(const digest& id,
+                                       const digest& contents) {
+    char buf[16];
+
+    for(int i = 0; i < 8; ++i) {
+      buf[i] = static_cast<char>(contents.lo >> (8 * i));
+      buf[i + 8] = static_cast<char>(contents.hi >> (8 * i));
+    }
+
+    return hash128(std::string_view(buf, 16), id);
+  }
+
+  // Slot hash of the open addressing tables in configuration images.
+  // Part of the image format, so it must not depend on the build.
+  inline std::uint64_t private_::image_hash(std::string_view s) {
+    return hash128(s, { 0, 3 }).lo;
+  }
+
+  // Recognizes what getval() reads as bool, an integer or a double:
+  // true/false, [+-]digits fitting 64 bits and decimal floating point.
+  // Runs of digits are checked eight bytes at a time.
+  inline private_::typed_value private_::classify(std::string_view s) {
+    typed_value tv;
+    tv.tag = typed_value::none;
+    tv.i = 0;
+
+    if(s == "true" || s == "false") {
+      tv.tag = typed_value::boolean;
+      tv.b = (s[0] == 't');
+      return tv;
+    }
+
+    const char* p = s.data();
+    const char* end = p + s.size();
+
+    auto digits = [&end](const char* q) {
+      while(end - q >= 8) {
+        std::uint64_t w;
+        std::memcpy(&w, q, 8);
+        // every byte in '0'..'9': high nibble 3 before and after adding 6
+        if((w & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL ||
+           ((w + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) !=
+             0x3030303030303030ULL) {
+          break;
+        }
+        q += 8;
+      }
+      while(q != end && *q >= '0' && *q <= '9') {
+        ++q;
+      }
+      return q;
+    };
+
+    const char* num = p;
+    if(p != end && (*p == '+' || *p == '-')) {
+      ++p;
+    }
+    // from_chars takes no plus sign
+    if(num != end && *num == '+') {
+      ++num;
+    }
+
+    const char* q = digits(p);
+    bool integral = (q != p);
+    bool mantissa = integral;
+
+    if(q != end && *q == '.') {
+      const char* frac = digits(q + 1);
+      mantissa = mantissa || (frac != q + 1);
+      integral = false;
+      q = frac;
+    }
+    if(mantissa && q != end && (*q == 'e' || *q == 'E')) {
+      const char* exp = q + 1;
+      if(exp != end && (*exp == '+' || *exp == '-')) {
+        ++exp;
+      }
+      const char* expend = digits(exp);
+      if(expend != exp) {
+        integral = false;
+        q = expend;
+      }
+    }
+    if(!mantissa || q != end) {
+      if(parse_duration(s, tv.i)) {
+        tv.tag = typed_value::duration;
+      }
+      else if(parse_size(s, tv.u)) {
+        tv.tag = typed_value::size;
+      }
+      return tv;
+    }
+
+    // -0 is a floating point zero, as it reads back as -0.0
+    if(integral && std::from_chars(num, end, tv.i).ec == std::errc() &&
+       !(tv.i == 0 && *s.data() == '-')) {
+      tv.tag = typed_value::integer;
+    }
+    else if(std::from_chars(num, end, tv.d).ec == std::errc()) {
+      tv.tag = typed_value::floating;
+    }
+
+    return tv;
+  }
+
+  namespace private_
+  {
+    // Reads digits[.digits] at p, keeping up to 9 fraction digits.
+    inline bool parse_decimal(const char*& p, const char* end,
+                              std::uint64_t& whole, std::uint64_t& frac,
+                              std::uint64_t& scale) {
+      const char* start = p;
+      whole = frac = 0;
+      scale = 1;
+
+      for(; p != end && *p >= '0' && *p <= '9'; ++p) {
+        if(whole > (UINT64_MAX - 9) / 10) {
+          return false;
+        }
+        whole = whole * 10 + (*p - '0');
+      }
+
+      bool digits = (p != start);
+      if(p != end && *p == '.') {
+        for(++p; p != end && *p >= '0' && *p <= '9'; ++p) {
+          digits = true;
+          if(scale < 1000000000) {
+            frac = frac * 10 + (*p - '0');
+            scale *= 10;
+          }
+        }
+      }
+
+      return digits;
+    }
+
+    // (whole + frac / scale) * unit, rounded down
+    inline bool scale_unit(std::uint64_t whole, std::uint64_t frac,
+                           std::uint64_t scale, std::uint64_t unit,
+                           std::uint64_t& out) {
+      if(unit && whole > UINT64_MAX / unit) {
+        return false;
+      }
+
+      // frac * unit / scale without overflow, as frac < scale <= 1e9
+      const std::uint64_t part = frac * (unit / scale) +
+                                 frac * (unit % scale) / scale;
+      if(whole * unit > UINT64_MAX - part) {
+        return false;
+      }
+
+      out = whole * unit + part;
+      return true;
+    }
+
+    inline bool is_letter(char c) {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    // Length of the unit at p and its factor, or 0 if none matches.
+    inline std::size_t match_unit(const char* p, const char* end,
+                                  const std::pair<const char*,
+                                                  std::uint64_t>* units,
+                                  std::uint64_t& factor) {
+      std::size_t best = 0;
+      const std::string_view rest(p, end - p);
+
+      // the longest unit wins, so "ms" is not read as "m"
+      for(; units->first; ++units) {
+        const std::size_t len = std::strlen(units->first);
+        if(len > best && rest.substr(0, len) == units->first &&
+           (len == rest.size() || !is_letter(rest[len]))) {
+          best = len;
+          factor = units->second;
+        }
+      }
+
+      return best;
+    }
+  }
+
+  inline bool private_::parse_duration(std::string_view s,
+                                       std::int64_t& ns) {
+    static const std::pair<const char*, std::uint64_t> units[] = {
+      { "ns", 1ULL }, { "us", 1000ULL }, { "\xc2\xb5s", 1000ULL },
+      { "ms", 1000000ULL }, { "s", 1000000000ULL },
+      { "m", 60000000000ULL }, { "min", 60000000000ULL },
+      { "h", 3600000000000ULL }, { "d", 86400000000000ULL },
+      { nullptr, 0 }
+    };
+
+    const char* p = s.data();
+    const char* end = p + s.size();
+    const bool negative = (p != end && *p == '-');
+    std::uint64_t total = 0;
+
+    if(p != end && (*p == '-' || *p == '+')) {
+      ++p;
+    }
+    if(std::string_view(p, end - p) == "0") {
+      ns = 0;
+      return true;
+    }
+
+    // one or more <number><unit>, optionally separated by blanks
+    do {
+      std::uint64_t whole, frac, scale, factor, part;
+
+      if(!parse_decimal(p, end, whole, frac, scale)) {
+        return false;
+      }
+      while(p != end && *p == ' ') {
+        ++p;
+      }
+
+      const std::size_t len = match_unit(p, end, units, factor);
+      if(!len || !scale_unit(whole, frac, scale, factor, part) ||
+         part > UINT64_MAX - total) {
+        return false;
+      }
+
+      total += part;
+      p += len;
+      while(p != end && *p == ' ') {
+        ++p;
+      }
+    } while(p != end);
+
+    if(total > std::uint64_t(INT64_MAX) + negative) {
+      return false;
+    }
+
+    // negated in unsigned arithmetic, so INT64_MIN works as well
+    ns = static_cast<std::int64_t>(negative ? 0 - total : total);
+    return true;
+  }
+
+  inline bool private_::parse_size(std::string_view s,
+                                   std::uint64_t& bytes) {
+    static const std::pair<const char*, std::uint64_t> units[] = {
+      { "B", 1ULL },
+      { "k", 1ULL << 10 }, { "K", 1ULL << 10 }, { "KiB", 1ULL << 10 },
+      { "M", 1ULL << 20 }, { "MiB", 1ULL << 20 },
+      { "G", 1ULL << 30 }, { "GiB", 1ULL << 30 },
+      { "T", 1ULL << 40 }, { "TiB", 1ULL << 40 },
+      { "P", 1ULL << 50 }, { "PiB", 1ULL << 50 },
+      { "E", 1ULL << 60 }, { "EiB", 1ULL << 60 },
+      { "kB", 1000ULL }, { "KB", 1000ULL },
+      { "MB", 1000000ULL }, { "GB", 1000000000ULL },
+      { "TB", 1000000000000ULL }, { "PB", 1000000000000000ULL },
+      { "EB", 1000000000000000000ULL },
+      { nullptr, 0 }
+    };
+
+    const char* p = s.data();
+    const char* end = p + s.size();
+    std::uint64_t whole, frac, scale, factor = 1;
+
+    if(p != end && *p == '+') {
+      ++p;
+    }
+    if(!parse_decimal(p, end, whole, frac, scale)) {
+      return false;
+    }
+    while(p != end && *p == ' ') {
+      ++p;
+    }
+    if(p != end) {
+      const std::size_t len = match_unit(p, end, units, factor);
+      if(len != static_cast<std::size_t>(end - p)) {
+        return false;
+      }
+    }
+
+    return scale_unit(whole, frac, scale, factor, bytes);
+  }
+
+  inline bool private_::is_space(char c) {
+    return byte_classes[c] & space_byte;
+  }
+
+  inline std::string_view private_::trim(std::string_view str) {
+    std::size_t begin = 0;
+    std::size_t end = str.size();
+
+    while(begin < end && is_space(str[begin])) {
+      ++begin;
+    }
+    while(end > begin && is_space(str[end - 1])) {
+      --end;
+    }
+
+    return str.substr(begin, end - begin);
+  }
+
+  // First LF or CR in [p, end), or nullptr. Eight bytes at a time: a
+  // byte of w ^ 0x0a0a... or w ^ 0x0d0d... is zero where w holds a line
+  // break, and (x - 0x0101...) & ~x has the top bit set in the lowest
+  // zero byte of x (and possibly above), so the word is only searched
+  // byte by byte once it contains a break.
+  inline const char* private_::find_line_break(const char* p,
+                                               const char* end) {
+    const std::uint64_t ones = 0x0101010101010101ULL;
+    const std::uint64_t highs = 0x8080808080808080ULL;
+
+    for(; end - p >= 8; p += 8) {
+      std::uint64_t w;
+      std::memcpy(&w, p, sizeof(w));
+
+      const std::uint64_t lf = w ^ (ones * '\n');
+      const std::uint64_t cr = w ^ (ones * '\r');
+
+      if((((lf - ones) & ~lf) | ((cr - ones) & ~cr)) & highs) {
+        break;
+      }
+    }
+
+    for(; p < end; ++p) {
+      if(*p == '\n' || *p == '\r') {
+        return p;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // The line without a leading UTF-8 byte order mark.
+  inline std::string_view private_::skip_bom(std::string_view line) {
+    if(line.substr(0, 3) == "\xEF\xBB\xBF") {
+      line.remove_prefix(3);
+    }
+    return line;
+  }
+
+  // Offset of the first byte of s that does not start a well-formed
+  // UTF-8 sequence, or npos. Runs of ASCII are skipped sixteen bytes at
+  // a time; other sequences are checked against the table of
+  // well-formed byte sequences of the Unicode standard (section 3.9).
+  inline std::size_t private_::find_invalid_utf8(std::string_view s) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+    const std::size_t n = s.size();
+    const std::uint64_t highs = 0x8080808080808080ULL;
+    std::uint64_t w[2];
+    std::size_t i = 0;
+
+    while(i < n) {
+      for(; n - i >= 16; i += 16) {
+        std::memcpy(w, p + i, sizeof(w));
+        if((w[0] | w[1]) & highs) {
+          break;
+        }
+      }
+
+      // an ASCII tail ends the check, overlapping what was checked
+      if(n - i <= 8 && n >= 8) {
+        std::memcpy(w, p + n - 8, 8);
+        if(!(w[0] & highs)) {
+          break;
+        }
+      }
+
+      while(i < n && p[i] < 0x80) {
+        ++i;
+      }
+      if(i == n) {
+        break;
+      }
+
+      const unsigned char c = p[i];
+
+      // length and range of the second byte
+      std::size_t len = 4;
+      unsigned char lo = 0x80;
+      unsigned char hi = 0xbf;
+
+      if(c >= 0xc2 && c <= 0xdf) {
+        len = 2;
+      }
+      else if(c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        lo = (c == 0xe0) ? 0xa0 : lo;  // overlong
+        hi = (c == 0xed) ? 0x9f : hi;  // surrogates
+      }
+      else if(c >= 0xf0 && c <= 0xf4) {
+        lo = (c == 0xf0) ? 0x90 : lo;  // overlong
+        hi = (c == 0xf4) ? 0x8f : hi;  // above U+10FFFF
+      }
+      else {
+        return i;
+      }
+
+      if(n - i < len || p[i + 1] < lo || p[i + 1] > hi) {
+        return i;
+      }
+      for(std::size_t k = 2; k < len; ++k) {
+        if((p[i + k] & 0xc0) != 0x80) {
+          return i;
+        }
+      }
+
+      i += len;
+    }
+
+    return std::string_view::npos;
+  }
+
+  // Checks base[checked, end) and advances checked, except over a
+  // sequence cut off at the end of a block that is not the final one.
+  // Returns the offset of the first invalid sequence, or npos.
+  inline std::size_t private_::check_utf8(const char* base,
+                                          std::size_t& checked,
+                                          std::size_t end, bool final) {
+    std::size_t stop = end;
+
+    if(!final) {
+      std::size_t k = end;
+
+      while(k > checked && end - k < 3 && (base[k - 1] & 0xc0) == 0x80) {
+        --k;
+      }
+
+      const unsigned char lead = (k > checked) ? base[k - 1] : 0;
+      const std::size_t len = (lead >= 0xf0) ? 4 : (lead >= 0xe0) ? 3 : 2;
+
+      if(lead >= 0xc0 && end - (k - 1) < len) {
+        stop = k - 1;
+      }
+    }
+
+    const std::size_t bad =
+      find_invalid_utf8(std::string_view(base + checked, stop - checked));
+
+    if(bad != std::string_view::npos) {
+      return checked + bad;
+    }
+
+    checked = stop;
+    return std::string_view::npos;
+  }
+
+  // One left-to-right scan over the line, which only records the
+  // bounds of the parts; the views are cut from them at the end.
+  inline private_::line_tokens private_::tokenize(std::string_view line) {
+    const char* p = line.data();
+    const std::size_t n = line.size();
+    const std::size_t npos = std::string_view::npos;
+    line_tokens tok = { line_tokens::blank, {}, {}, {} };
+    std::size_t i = 0;
+
+    while(i < n && is_space(p[i])) {
+      ++i;
+    }
+
+    // ignore empty lines
+    if(i == n) {
+      return tok;
+    }
+
+    // sections end at the first closing bracket; comment marks inside
+    // the brackets are part of the name
+    if(p[i] == '[') {
+      std::size_t kbegin = npos;
+      std::size_t kend = i + 1;
+
+      for(++i; i < n && p[i] != ']'; ++i) {
+        if(!is_space(p[i])) {
+          kbegin = (kbegin == npos) ? i : kbegin;
+          kend = i + 1;
+        }
+      }
+
+      const std::size_t close = i;
+
+      if(close < n) {
+        for(++i; i < n && is_space(p[i]); ++i) {
+          /* only whitespace or a comment may follow */
+        }
+      }
+
+      if(close == n || (i < n && p[i] != '#' && p[i] != ';')) {
+        tok.kind = line_tokens::bad_section;
+        tok.text = trim(line);
+        return tok;
+      }
+
+      tok.kind = line_tokens::section;
+      tok.key = (kbegin == npos) ? line.substr(close, 0)
+                                 : line.substr(kbegin, kend - kbegin);
+      return tok;
+    }
+
+    // entry: split by the first "=" before any comment, and trim
+    const std::size_t begin = i;
+    std::size_t end = begin;
+
+    for(; i < n; ++i) {
+      const unsigned cls = byte_classes[p[i]];
+
+      if(cls & (comment_byte | equals_byte)) {
+        break;
+      }
+      if(!(cls & space_byte)) {
+        end = i + 1;
+      }
+    }
+
+    if(i == n || p[i] != '=') {
+      // ignore comments
+      if(end != begin) {
+        tok.kind = line_tokens::bad_line;
+        tok.text = line.substr(begin, end - begin);
+      }
+      return tok;
+    }
+
+    tok.kind = line_tokens::entry;
+    tok.key = line.substr(begin, end - begin);
+
+    const std::size_t eqpos = i;
+
+    for(++i; i < n && is_space(p[i]); ++i) {
+      /* skip to the value */
+    }
+
+    std::size_t vbegin = i;
+    end = i;
+
+    for(; i < n; ++i) {
+      const unsigned cls = byte_classes[p[i]];
+
+      if(cls & comment_byte) {
+        break;
+      }
+      if(!(cls & space_byte)) {
+        end = i + 1;
+      }
+    }
+
+    // an empty value stays right after the "=", not past the line
+    // break, so that inidocument writes a new value in its place
+    if(end == vbegin) {
+      vbegin = end = eqpos + 1;
+    }
+
+    tok.value = line.substr(vbegin, end - vbegin);
+    return tok;
+  }
+
+
+  inline void private_::check_representable(std::string_view s,
+                                            const char* reject,
+                                            const char* what) {
+    if(s.find_first_of(reject) != std::string_view::npos ||
+       trim(s).size() != s.size()) {
+      throw syntax_error("The " + std::string(what) + " '" + std::string(s) +
+                         "' cannot be written to an ini file.");
+    }
+  }
+
+  inline void private_::check_representable(std::string_view key,
+                                            std::string_view value) {
+    // a leading bracket would turn the entry into a section header
+    check_representable(key, key.compare(0, 1, "[") ? "=#;\r\n" : "[",
+                        "key");
+    check_representable(value, "#;\r\n", "value");
   }
 }
 
@@ -29,6 +29,53 @@
 
 #include <inipp.hh>
 
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+#ifdef INIPP_WITH_SHM
+#include <sys/wait.h>
+#endif
+
+namespace
+{
+  // global operator new calls while enabled
+  std::atomic<bool> count_allocations(false);
+  std::atomic<std::size_t> allocations(0);
+}
+
+void* operator new(std::size_t size) {
+  if(count_allocations) {
+    ++allocations;
+  }
+  if(void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+// Optimising GCC inlines these into callers of new and then warns
+// that free() gets a pointer from operator new, not knowing that the
+// operator new above is malloc().
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
 BOOST_AUTO_TEST_CASE( sunshine_inifile )
 {
   std::ifstream cstream("tests-sunshine.conf");
@@ -100,3 +147,1325 @@ BOOST_AUTO_TEST_CASE( malformed )
   // But no error afterwards.
   BOOST_REQUIRE_NO_THROW(inipp::inifile cfile(cstream));
 }
+
+BOOST_AUTO_TEST_CASE( document_roundtrip )
+{
+  std::ifstream cstream("tests-sunshine.conf");
+  std::string original((std::istreambuf_iterator<char>(cstream)),
+                       std::istreambuf_iterator<char>());
+  inipp::inidocument doc(original);
+
+  // untouched documents are written out byte for byte
+  BOOST_REQUIRE_EQUAL(doc.str(), original);
+  BOOST_REQUIRE_EQUAL(doc.get("rule the world", "use lolcats"), "en masse");
+
+  doc.set("rule the world", "use lolcats", "sparingly");
+  doc.set("rule the world", "use of force", "never");
+  doc.set("inipp", "is borked");
+  doc.set("brand new", "entry", "value");
+  BOOST_REQUIRE(doc.erase("sp3c14|_ c#4r4c73r2", "do"));
+  BOOST_REQUIRE(!doc.erase("sp3c14|_ c#4r4c73r2", "do"));
+  BOOST_REQUIRE(!doc.erase("nosection", "do"));
+
+  BOOST_REQUIRE_EQUAL(doc.get("rule the world", "use lolcats"), "sparingly");
+  BOOST_REQUIRE_THROW(doc.get("sp3c14|_ c#4r4c73r2", "do"),
+                      inipp::unknown_entry_error);
+  BOOST_REQUIRE_THROW(doc.set("a", "b", "c # d"), inipp::syntax_error);
+  BOOST_REQUIRE_THROW(doc.set("[a", "b"), inipp::syntax_error);
+
+  // comments and layout survive, edits reparse to the same values
+  const std::string edited = doc.str();
+  BOOST_REQUIRE(edited.find("# this is a comment with a = sign\n") == 0);
+  BOOST_REQUIRE(edited.find("  [   whitespace aplenty   ]\n") !=
+                std::string::npos);
+
+  std::istringstream estream(edited);
+  inipp::inifile cfile(estream);
+
+  BOOST_REQUIRE_EQUAL(cfile.get("inipp"), "is borked");
+  BOOST_REQUIRE_EQUAL(cfile.get("everything"), "borked");
+  BOOST_REQUIRE_EQUAL(cfile.get("rule the world", "use lolcats"),
+                      "sparingly");
+  BOOST_REQUIRE_EQUAL(cfile.get("rule the world", "use of force"), "never");
+  BOOST_REQUIRE_EQUAL(cfile.get("brand new", "entry"), "value");
+  BOOST_REQUIRE_THROW(cfile.get("sp3c14|_ c#4r4c73r2", "do"),
+                      inipp::unknown_entry_error);
+  BOOST_REQUIRE_EQUAL(cfile.get("whitespace aplenty", "these are double"),
+                      "= signs");
+
+  // empty values are filled in on their own line
+  const char* empty[][2] = {
+    { "[s]\nk=\nj=1\n", "[s]\nk= v\nj=1\n" },
+    { "[s]\nk =   \nj=1\n", "[s]\nk = v   \nj=1\n" },
+    { "[s]\r\nk=\r\nj=1\r\n", "[s]\r\nk= v\r\nj=1\r\n" },
+    { "[s]\nk= ;c\nj=1\n", "[s]\nk= v ;c\nj=1\n" },
+  };
+
+  // erasing what set() added restores the document, including the
+  // header of a section it appended
+  inipp::inidocument undo(original);
+  undo.set("brand new", "entry", "value");
+  undo.set("brand new", "other", "value");
+  undo.set("rule the world", "use of force", "never");
+  BOOST_REQUIRE(undo.erase("brand new", "entry"));
+  BOOST_REQUIRE_EQUAL(undo.get("brand new", "other"), "value");
+  BOOST_REQUIRE(undo.erase("brand new", "other"));
+  BOOST_REQUIRE(undo.erase("rule the world", "use of force"));
+  BOOST_REQUIRE_EQUAL(undo.str(), original);
+  BOOST_REQUIRE_THROW(undo.get("brand new", "other"),
+                      inipp::unknown_section_error);
+  BOOST_REQUIRE(!undo.erase("brand new", "other"));
+  undo.set("brand new", "entry", "again");
+  BOOST_REQUIRE_EQUAL(undo.str(),
+                      original + "\n[brand new]\nentry = again\n");
+
+  // streams are read from their position, seekable or not
+  std::istringstream rest("skipped\n" + original);
+  std::string skipped;
+  std::getline(rest, skipped);
+  BOOST_REQUIRE_EQUAL(inipp::inidocument(rest).str(), original);
+  std::istringstream raw(original);
+  inipp::decompressing_istream unseekable(raw, 16);
+  BOOST_REQUIRE_EQUAL(inipp::inidocument(unseekable).str(), original);
+
+  for(const auto& e : empty) {
+    inipp::inidocument edoc{std::string(e[0])};
+
+    edoc.set("s", "k", "v");
+    BOOST_REQUIRE_EQUAL(edoc.str(), e[1]);
+
+    std::istringstream rstream(edoc.str());
+    inipp::inifile rfile(rstream);
+
+    BOOST_REQUIRE_EQUAL(rfile.get("s", "k"), "v");
+    BOOST_REQUIRE_EQUAL(rfile.get("s", "j"), "1");
+  }
+}
+
+BOOST_AUTO_TEST_CASE( modification )
+{
+  std::ifstream cstream("tests-sunshine.conf");
+  inipp::inifile cfile(cstream);
+  std::uint64_t version = cfile.version();
+
+  cfile.set("rule the world", "use lolcats", "sparingly");
+  cfile.set("everything", "fine");
+  cfile.set("new section", "new", "entry");
+  BOOST_REQUIRE_EQUAL(cfile.get("rule the world", "use lolcats"),
+                      "sparingly");
+  BOOST_REQUIRE_EQUAL(cfile.get("everything"), "fine");
+  BOOST_REQUIRE_EQUAL(cfile.section("new section").get("new"), "entry");
+  BOOST_REQUIRE_EQUAL(cfile.version(), version + 3);
+
+  // unchanged values and missing entries leave the version alone
+  cfile.set("everything", "fine");
+  BOOST_REQUIRE(!cfile.erase("rule the world", "use loldogs"));
+  BOOST_REQUIRE(!cfile.erase("nosection", "use lolcats"));
+  BOOST_REQUIRE_EQUAL(cfile.version(), version + 3);
+
+  BOOST_REQUIRE(cfile.erase("rule the world", "use lolcats"));
+  BOOST_REQUIRE(cfile.erase("inipp"));
+  BOOST_REQUIRE_THROW(cfile.get("rule the world", "use lolcats"),
+                      inipp::unknown_entry_error);
+  BOOST_REQUIRE_THROW(cfile.get("inipp"), inipp::unknown_entry_error);
+  BOOST_REQUIRE_EQUAL(cfile.version(), version + 5);
+}
+
+BOOST_AUTO_TEST_CASE( difference )
+{
+  std::ifstream astream("tests-sunshine.conf");
+  std::ifstream bstream("tests-sunshine.conf");
+  inipp::inifile a(astream);
+  inipp::inifile b(bstream);
+
+  BOOST_REQUIRE(inipp::diff(a, b).empty());
+
+  b.set("rule the world", "use lolcats", "sparingly");
+  b.set("rule the world", "use of force", "never");
+  b.erase("inipp");
+  b.set("new section", "new", "entry");
+  b.erase("sp3c14|_ c#4r4c73r2", "do");
+
+  const std::vector<inipp::change> changes = inipp::diff(a, b);
+  BOOST_REQUIRE_EQUAL(changes.size(), 5);
+
+  BOOST_REQUIRE(changes[0].default_section);
+  BOOST_REQUIRE_EQUAL(changes[0].kind, inipp::change::removed);
+  BOOST_REQUIRE_EQUAL(changes[0].key, "inipp");
+  BOOST_REQUIRE_EQUAL(changes[0].old_value, "may not be borked");
+
+  BOOST_REQUIRE_EQUAL(changes[1].kind, inipp::change::added);
+  BOOST_REQUIRE_EQUAL(changes[1].section, "new section");
+  BOOST_REQUIRE_EQUAL(changes[1].new_value, "entry");
+
+  BOOST_REQUIRE_EQUAL(changes[2].kind, inipp::change::changed);
+  BOOST_REQUIRE_EQUAL(changes[2].key, "use lolcats");
+  BOOST_REQUIRE_EQUAL(changes[2].old_value, "en masse");
+  BOOST_REQUIRE_EQUAL(changes[2].new_value, "sparingly");
+
+  BOOST_REQUIRE_EQUAL(changes[3].kind, inipp::change::added);
+  BOOST_REQUIRE_EQUAL(changes[3].key, "use of force");
+
+  BOOST_REQUIRE_EQUAL(changes[4].kind, inipp::change::removed);
+  BOOST_REQUIRE_EQUAL(changes[4].section, "sp3c14|_ c#4r4c73r2");
+
+  // section hashes follow modifications back to the original state
+  b.set("rule the world", "use lolcats", "en masse");
+  b.erase("rule the world", "use of force");
+  BOOST_REQUIRE_EQUAL(inipp::diff(a, b).size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE( fingerprints )
+{
+  std::ifstream astream("tests-sunshine.conf");
+  inipp::inifile a(astream);
+
+  // same entries, different order, whitespace and comments
+  std::istringstream bstream(
+    "[sp3c14|_ c#4r4c73r2]\n"
+    "do=work in inipp ; comment\n"
+    "[   whitespace aplenty]\n"
+    "these are double = = signs\n"
+    "[rule the world]\n"
+    "but do not = fall over laughing\n"
+    "[rule the world]\n"
+    "use lolcats = en masse\n");
+  inipp::inifile b(bstream);
+
+  BOOST_REQUIRE(a.fingerprint() != b.fingerprint());
+  BOOST_REQUIRE(a.fingerprint("rule the world") ==
+                b.fingerprint("rule the world"));
+  BOOST_REQUIRE_THROW(a.fingerprint("nosection"),
+                      inipp::unknown_section_error);
+
+  b.set("everything", "borked");
+  b.set("inipp", "may not be borked");
+  BOOST_REQUIRE(a.fingerprint() == b.fingerprint());
+  BOOST_REQUIRE_EQUAL(a.fingerprint().str().size(), 32);
+
+  // entries moved between sections change the fingerprint
+  b.erase("rule the world", "use lolcats");
+  b.set("sp3c14|_ c#4r4c73r2", "use lolcats", "en masse");
+  BOOST_REQUIRE(a.fingerprint() != b.fingerprint());
+  b.erase("sp3c14|_ c#4r4c73r2", "use lolcats");
+  b.set("rule the world", "use lolcats", "en masse");
+  BOOST_REQUIRE(a.fingerprint() == b.fingerprint());
+
+  // fixed value, guards against accidental changes to the hash
+  std::istringstream cstream("[a]\nb = c\n");
+  BOOST_REQUIRE_EQUAL(inipp::inifile(cstream).fingerprint().str(),
+                      "1ea4225587ec44c73bacc3066871f953");
+}
+
+BOOST_AUTO_TEST_CASE( concurrent_readers )
+{
+  std::ifstream cstream("tests-sunshine.conf");
+  const inipp::inifile cfile(cstream);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> readers;
+
+  for(int t = 0; t < 8; ++t) {
+    readers.emplace_back([&cfile, &failures]() {
+      inipp::inisection rule = cfile.section("rule the world");
+
+      for(int i = 0; i < 2000; ++i) {
+        if(cfile.get("everything") != "borked" ||
+           cfile.dget("sp3c14|_ c#4r4c73r2", "are", "funky") != "funky" ||
+           rule.get("use lolcats") != "en masse" ||
+           cfile.getval("rule the world", "but do not", std::string()) !=
+             "fall over laughing" ||
+           cfile.getval("nosection", "number", 42) != 42) {
+          ++failures;
+        }
+      }
+    });
+  }
+
+  for(std::thread& reader : readers) {
+    reader.join();
+  }
+
+  BOOST_REQUIRE_EQUAL(failures.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE( reloadable_snapshots )
+{
+  std::istringstream astream("[a]\nx = 0\ny = 0\n");
+  inipp::reloadable holder{inipp::inifile(astream)};
+  std::atomic<bool> stop(false);
+  std::atomic<int> failures(0);
+  std::vector<std::thread> readers;
+
+  BOOST_REQUIRE_EQUAL(holder.current().get("a", "x"), "0");
+  BOOST_REQUIRE_EQUAL(holder.epoch(), 1);
+
+  // every snapshot a reader sees must be internally consistent
+  for(int t = 0; t < 4; ++t) {
+    readers.emplace_back([&]() {
+      while(!stop) {
+        const inipp::inifile& cfg = holder.current();
+        if(cfg.get("a", "x") != cfg.get("a", "y")) {
+          ++failures;
+        }
+      }
+    });
+  }
+
+  for(int i = 1; i <= 200; ++i) {
+    std::istringstream in("[a]\nx = " + std::to_string(i) +
+                          "\ny = " + std::to_string(i) + "\n");
+    holder.publish(inipp::inifile(in));
+  }
+
+  stop = true;
+  for(std::thread& reader : readers) {
+    reader.join();
+  }
+
+  BOOST_REQUIRE_EQUAL(failures.load(), 0);
+  BOOST_REQUIRE_EQUAL(holder.epoch(), 201);
+  BOOST_REQUIRE_EQUAL(holder.current().get("a", "x"), "200");
+  BOOST_REQUIRE_EQUAL(holder.snapshot()->get("a", "y"), "200");
+
+  // null configurations are rejected and leave the holder alone
+  const std::shared_ptr<const inipp::inifile> null;
+  BOOST_REQUIRE_THROW(inipp::reloadable{null}, std::invalid_argument);
+  BOOST_REQUIRE_THROW(holder.publish(null), std::invalid_argument);
+  BOOST_REQUIRE_EQUAL(holder.epoch(), 201);
+  BOOST_REQUIRE_EQUAL(holder.current().get("a", "x"), "200");
+
+  // several holders share the per-thread cache
+  std::vector<std::unique_ptr<inipp::reloadable>> holders;
+  for(int i = 0; i < 6; ++i) {
+    std::istringstream in("x = " + std::to_string(i) + "\n");
+    holders.emplace_back(new inipp::reloadable(inipp::inifile(in)));
+  }
+  for(int round = 0; round < 2; ++round) {
+    for(int i = 0; i < 6; ++i) {
+      BOOST_REQUIRE_EQUAL(holders[i]->current().get("x"), std::to_string(i));
+    }
+  }
+
+  // snapshots of a destroyed holder are released by every thread that
+  // cached one on its next current() of any holder
+  std::weak_ptr<const inipp::inifile> gone;
+  std::mutex step;
+  std::condition_variable stepped;
+  int stage = 0;
+  std::thread reader([&]() {
+    std::unique_lock<std::mutex> lock(step);
+    holders[0]->current();
+    holders[5]->current();
+    stage = 1;
+    stepped.notify_all();
+    stepped.wait(lock, [&]() { return stage == 2; });
+    holders[5]->current();
+    stage = 3;
+    stepped.notify_all();
+  });
+  {
+    std::unique_lock<std::mutex> lock(step);
+    stepped.wait(lock, [&]() { return stage == 1; });
+    gone = holders[0]->snapshot();
+    holders[0]->current();
+    holders[0].reset();
+    BOOST_REQUIRE(!gone.expired());
+    holders[5]->current();
+    stage = 2;
+    stepped.notify_all();
+    stepped.wait(lock, [&]() { return stage == 3; });
+  }
+  reader.join();
+  BOOST_REQUIRE(gone.expired());
+}
+
+BOOST_AUTO_TEST_CASE( reload_notifications )
+{
+  std::vector<inipp::change> keychanges;
+  std::vector<inipp::change> sectionchanges;
+  int keycalls = 0;
+  int sectioncalls = 0;
+  int defaultcalls = 0;
+  int cancelledcalls = 0;
+  int throwingcalls = 0;
+
+  {
+    std::istringstream astream("d = 1\n[a]\nx = 1\ny = 1\n[b]\nz = 1\n");
+    inipp::reloadable holder{inipp::inifile(astream)};
+
+    holder.subscribe("a", "x", [&](const std::vector<inipp::change>& c) {
+      keychanges = c;
+      ++keycalls;
+    });
+    holder.subscribe("b", [&](const std::vector<inipp::change>& c) {
+      sectionchanges = c;
+      ++sectioncalls;
+    });
+    holder.subscribe_default("d", [&](const std::vector<inipp::change>&) {
+      ++defaultcalls;
+    });
+    holder.unsubscribe(
+      holder.subscribe("a", [&](const std::vector<inipp::change>&) {
+        ++cancelledcalls;
+      }));
+
+    // a throwing callback neither stops the dispatcher nor loses its
+    // subscription
+    holder.subscribe("a", "y", [&](const std::vector<inipp::change>&) {
+      ++throwingcalls;
+      throw std::runtime_error("callback failed");
+    });
+
+    std::istringstream bstream("d = 1\n[a]\nx = 2\ny = 2\n[b]\nw = 1\n");
+    holder.reload(bstream);
+    std::istringstream cstream("d = 1\n[a]\nx = 2\ny = 3\n[b]\nw = 1\n");
+    holder.reload(cstream);
+
+    // destroying the holder delivers all queued notifications
+  }
+
+  BOOST_REQUIRE_EQUAL(keycalls, 1);
+  BOOST_REQUIRE_EQUAL(keychanges.size(), 1);
+  BOOST_REQUIRE_EQUAL(keychanges[0].kind, inipp::change::changed);
+  BOOST_REQUIRE_EQUAL(keychanges[0].new_value, "2");
+
+  BOOST_REQUIRE_EQUAL(sectioncalls, 1);
+  BOOST_REQUIRE_EQUAL(sectionchanges.size(), 2);
+  BOOST_REQUIRE_EQUAL(sectionchanges[0].key, "w");
+  BOOST_REQUIRE_EQUAL(sectionchanges[1].kind, inipp::change::removed);
+
+  BOOST_REQUIRE_EQUAL(defaultcalls, 0);
+  BOOST_REQUIRE_EQUAL(cancelledcalls, 0);
+  BOOST_REQUIRE_EQUAL(throwingcalls, 2);
+}
+
+BOOST_AUTO_TEST_CASE( compressed_input )
+{
+  std::ifstream pstream("tests-sunshine.conf");
+  const inipp::inifile plain(pstream);
+
+  // gzip is decompressed in small blocks to cross block boundaries
+  std::ifstream zfile("tests-sunshine.conf.gz", std::ios::binary);
+  inipp::decompressing_istream zstream(zfile, 16);
+  const inipp::inifile compressed(zstream);
+
+  BOOST_REQUIRE(plain.fingerprint() == compressed.fingerprint());
+  BOOST_REQUIRE_EQUAL(compressed.get("rule the world", "use lolcats"),
+                      "en masse");
+
+  // uncompressed input passes through
+  std::ifstream tfile("tests-sunshine.conf");
+  inipp::decompressing_istream tstream(tfile, 7);
+  BOOST_REQUIRE(inipp::inifile(tstream).fingerprint() == plain.fingerprint());
+
+  // truncated input throws instead of yielding a partial config
+  std::ifstream gzfile("tests-sunshine.conf.gz", std::ios::binary);
+  std::string gz((std::istreambuf_iterator<char>(gzfile)),
+                 std::istreambuf_iterator<char>());
+  std::istringstream truncated(gz.substr(0, gz.size() - 12));
+  inipp::decompressing_istream tzstream(truncated);
+  BOOST_REQUIRE_THROW(inipp::inifile cfile(tzstream), inipp::syntax_error);
+
+  std::ifstream zstfile("tests-sunshine.conf.zst", std::ios::binary);
+  std::string zst((std::istreambuf_iterator<char>(zstfile)),
+                  std::istreambuf_iterator<char>());
+#ifdef INIPP_WITH_ZSTD
+  // zstd likewise, also as two concatenated frames
+  std::ifstream textfile("tests-sunshine.conf");
+  const std::string text((std::istreambuf_iterator<char>(textfile)),
+                         std::istreambuf_iterator<char>());
+  for(int frames = 1; frames <= 2; ++frames) {
+    std::istringstream raw(frames == 1 ? zst : zst + zst);
+    inipp::decompressing_istream zststream(raw, 16);
+    std::string out((std::istreambuf_iterator<char>(zststream)),
+                    std::istreambuf_iterator<char>());
+    BOOST_REQUIRE(out == (frames == 1 ? text : text + text));
+  }
+
+  std::istringstream zraw(zst);
+  inipp::decompressing_istream zststream(zraw, 16);
+  BOOST_REQUIRE(inipp::inifile(zststream).fingerprint() ==
+                plain.fingerprint());
+
+  std::istringstream ztruncated(zst.substr(0, zst.size() - 5));
+  inipp::decompressing_istream tzststream(ztruncated, 16);
+  BOOST_REQUIRE_THROW(inipp::inifile cfile(tzststream), inipp::syntax_error);
+#else
+  // without support zstd input is refused rather than parsed as text
+  std::istringstream zraw(zst);
+  BOOST_REQUIRE_THROW(inipp::decompressing_istream zststream(zraw),
+                      inipp::syntax_error);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( bounded_streaming )
+{
+  inipp::parse_options options;
+  options.buffer_size = 16;
+  options.max_line_length = 40;
+
+  // lines cross the tiny buffer's boundaries
+  std::ifstream cstream("tests-sunshine.conf");
+  std::vector<std::string> events;
+  inipp::parse(cstream, [&](const inipp::parse_event& ev) {
+    if(ev.kind == inipp::parse_event::header) {
+      events.push_back("[" + std::string(ev.section) + "]");
+    }
+    else {
+      events.push_back((ev.default_section ? "" : std::string(ev.section)) +
+                       "/" + std::string(ev.key) + "=" +
+                       std::string(ev.value) + "@" + std::to_string(ev.line));
+    }
+  }, options);
+
+  BOOST_REQUIRE_EQUAL(events.size(), 9);
+  BOOST_REQUIRE_EQUAL(events[0], "/everything=borked@3");
+  BOOST_REQUIRE_EQUAL(events[2], "[rule the world]");
+  BOOST_REQUIRE_EQUAL(events[3], "rule the world/use lolcats=en masse@7");
+  BOOST_REQUIRE_EQUAL(events[8],
+                      "whitespace aplenty/these are double== signs@14");
+
+  // over-long lines are errors, not unbounded allocations
+  std::istringstream longstream("a = 1\nb = " + std::string(100, 'x') +
+                                "\nc = 3\n");
+  BOOST_REQUIRE_THROW(inipp::inifile cfile(longstream, options),
+                      inipp::syntax_error);
+  std::istringstream endless("[" + std::string(100000, 'x'));
+  BOOST_REQUIRE_THROW(inipp::inifile cfile(endless, options),
+                      inipp::syntax_error);
+
+  std::ifstream fstream("tests-sunshine.conf");
+  const inipp::inifile cfile(fstream, options);
+  BOOST_REQUIRE_EQUAL(cfile.get("whitespace aplenty", "these are double"),
+                      "= signs");
+
+  // without a limit, lines longer than the buffer grow it
+  const std::string huge(70000, 'x');
+  std::istringstream hugestream("a = 1\nb = " + huge + "\nc = 3");
+  const inipp::inifile hfile(hugestream);
+  BOOST_REQUIRE_EQUAL(hfile.get("b"), huge);
+  BOOST_REQUIRE_EQUAL(hfile.get("c"), "3");
+
+  inipp::parse_options unlimited;
+  unlimited.buffer_size = 16;
+  std::istringstream smallstream("a = " + huge + "\n[" + huge + "]\nc=3\n");
+  const inipp::inifile sfile(smallstream, unlimited);
+  BOOST_REQUIRE_EQUAL(sfile.get("a"), huge);
+  BOOST_REQUIRE_EQUAL(sfile.get(huge, "c"), "3");
+}
+
+BOOST_AUTO_TEST_CASE( memory_resource )
+{
+  std::ifstream file("tests-sunshine.conf");
+  std::istringstream cstream(std::string(
+    (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()));
+
+  static char region[1 << 16];
+  std::pmr::monotonic_buffer_resource arena(region, sizeof(region),
+                                            std::pmr::null_memory_resource());
+  inipp::parse_options options;
+  options.buffer_size = 1024;
+  options.max_line_length = 256;
+  std::optional<inipp::inifile> cfile;
+  const std::string value("is a bad idea after all");
+
+  // everything, including the read buffer, comes from the arena
+  allocations = 0;
+  count_allocations = true;
+  cfile.emplace(cstream, options, &arena);
+  cfile->set("rule the world", "use of force", value);
+  cfile->set("new section", "new", "entry");
+  count_allocations = false;
+
+  BOOST_REQUIRE_EQUAL(allocations.load(), 0);
+  BOOST_REQUIRE_EQUAL(cfile->get("rule the world", "use lolcats"),
+                      "en masse");
+  BOOST_REQUIRE_EQUAL(cfile->get("rule the world", "use of force"),
+                      "is a bad idea after all");
+
+  // a move keeps the resource, including for the default section, and
+  // a copy goes to the default resource
+  static_assert(std::is_nothrow_move_constructible<inipp::inifile>::value,
+                "inifile moves must not allocate");
+  BOOST_REQUIRE_EQUAL(cfile->get("everything"), "borked");
+  std::pmr::memory_resource* previous =
+    std::pmr::set_default_resource(std::pmr::null_memory_resource());
+  std::optional<inipp::inifile> moving;
+  BOOST_CHECK_NO_THROW(moving.emplace(std::move(*cfile)));
+  std::pmr::set_default_resource(previous);
+  BOOST_REQUIRE(moving);
+
+  inipp::inifile moved(std::move(*moving));
+  inipp::inifile copied(moved);
+  BOOST_REQUIRE_EQUAL(moved.get("everything"), "borked");
+  BOOST_REQUIRE_EQUAL(moved.get("new section", "new"), "entry");
+  BOOST_REQUIRE(moved.fingerprint() == copied.fingerprint());
+}
+
+BOOST_AUTO_TEST_CASE( shared_image )
+{
+  std::ifstream cstream("tests-sunshine.conf");
+  inipp::inifile cfile(cstream);
+  cfile.set("empty", "gone", "soon");
+  cfile.erase("empty", "gone");
+
+  std::vector<std::uint64_t> buf(cfile.image_size() / 8);
+  cfile.write_image(buf.data());
+  const inipp::inifile image =
+    inipp::inifile::attach(buf.data(), cfile.image_size());
+
+  // same answers without parsing or copying
+  BOOST_REQUIRE(inipp::diff(cfile, image).empty());
+  BOOST_REQUIRE(image.fingerprint() == cfile.fingerprint());
+  BOOST_REQUIRE(image.fingerprint("rule the world") ==
+                cfile.fingerprint("rule the world"));
+  BOOST_REQUIRE_EQUAL(image.get("everything"), "borked");
+  BOOST_REQUIRE_EQUAL(image.section("rule the world").get("use lolcats"),
+                      "en masse");
+  BOOST_REQUIRE_EQUAL(image.getval("sp3c14|_ c#4r4c73r2", "do", "x"),
+                      "work in inipp");
+  BOOST_REQUIRE_NO_THROW(image.section("empty"));
+  BOOST_REQUIRE_THROW(image.get("nosection", "key"),
+                      inipp::unknown_section_error);
+  BOOST_REQUIRE_THROW(image.get("rule the world", "nokey"),
+                      inipp::unknown_entry_error);
+  BOOST_REQUIRE_THROW(image.get("nokey"), inipp::unknown_entry_error);
+  BOOST_REQUIRE_THROW(inipp::inifile(image).set("a", "b"), std::logic_error);
+
+  // diff works across representations
+  cfile.set("rule the world", "use lolcats", "sparingly");
+  BOOST_REQUIRE_EQUAL(inipp::diff(image, cfile).size(), 1);
+
+  // images of images are identical
+  const inipp::inifile empty;
+  std::vector<std::uint64_t> ebuf(empty.image_size() / 8);
+  empty.write_image(ebuf.data());
+  const inipp::inifile eimage =
+    inipp::inifile::attach(ebuf.data(), empty.image_size());
+  BOOST_REQUIRE_THROW(eimage.section("a"), inipp::unknown_section_error);
+  BOOST_REQUIRE(eimage.fingerprint() == empty.fingerprint());
+
+  std::vector<std::uint64_t> copy(image.image_size() / 8);
+  image.write_image(copy.data());
+  BOOST_REQUIRE(copy == buf);
+
+  // corrupt images either throw or answer every lookup within bounds
+  std::vector<std::uint64_t> bad(buf);
+  std::uint32_t* words = reinterpret_cast<std::uint32_t*>(bad.data());
+  for(std::size_t w = 2; w < bad.size() * 2; ++w) {
+    for(std::uint32_t v : { 0u, 1u, 2u, 0x7fu, 0xffffffffu }) {
+      const std::uint32_t old = words[w];
+      words[w] = (v == 1) ? old + 1 : v;
+      try {
+        const inipp::inifile corrupt =
+          inipp::inifile::attach(bad.data(), bad.size() * 8);
+        inipp::diff(corrupt, cfile);
+        corrupt.dget("rule the world", "use lolcats", "");
+        corrupt.dget("nosection", "key", "");
+      }
+      catch(const inipp::syntax_error&) {
+      }
+      words[w] = old;
+    }
+  }
+
+  buf[0] = 0;
+  BOOST_REQUIRE_THROW(inipp::inifile::attach(buf.data(), buf.size() * 8),
+                      inipp::syntax_error);
+
+#ifdef INIPP_WITH_SHM
+  const std::string name = "/inipp-tests-" + std::to_string(::getpid());
+  inipp::shm_publish(name, image);
+  BOOST_REQUIRE_THROW(inipp::shm_publish(name, image), std::system_error);
+
+  // another process attaches to the same pages
+  const pid_t child = ::fork();
+  if(child == 0) {
+    const inipp::inifile shared = inipp::shm_attach(name);
+    ::_exit(shared.get("rule the world", "use lolcats") == "en masse" &&
+            shared.fingerprint() == image.fingerprint() ? 0 : 1);
+  }
+  int status = -1;
+  ::waitpid(child, &status, 0);
+  BOOST_REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // attached configurations outlive the object's name
+  const inipp::inifile shared = inipp::shm_attach(name);
+  BOOST_REQUIRE(inipp::shm_remove(name));
+  BOOST_REQUIRE(!inipp::shm_remove(name));
+  BOOST_REQUIRE(inipp::diff(shared, image).empty());
+  BOOST_REQUIRE_THROW(inipp::shm_attach(name), std::system_error);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE( batch_lookup )
+{
+  std::ifstream cstream("tests-sunshine.conf");
+  inipp::inifile cfile(cstream);
+  cfile.set("typed", "port", "8080");
+  cfile.set("typed", "ratio", "0.5");
+  cfile.set("typed", "debug", "true");
+  cfile.set("typed", "name", " spaced out ");
+  cfile.set("typed", "broken", "12abc");
+
+  const std::vector<std::string_view> keys = {
+    "use lolcats", "nokey", "but do not", "use lolcats"
+  };
+  const auto values = cfile.lookup("rule the world", keys);
+  BOOST_REQUIRE_EQUAL(values.size(), 4);
+  BOOST_REQUIRE(values[0] && *values[0] == "en masse");
+  BOOST_REQUIRE(!values[1]);
+  BOOST_REQUIRE(values[2] && *values[2] == "fall over laughing");
+  BOOST_REQUIRE(values[3] && *values[3] == "en masse");
+  BOOST_REQUIRE_THROW(cfile.lookup("nosection", keys),
+                      inipp::unknown_section_error);
+
+  int port = 0;
+  double ratio = 0;
+  bool debug = false;
+  std::string name;
+  int broken = 0;
+  long missing = 0;
+  inipp::field fields[] = {
+    inipp::bind("port", port),
+    inipp::bind("ratio", ratio),
+    inipp::bind("debug", debug),
+    inipp::bind("name", name),
+    inipp::bind("broken", broken, 7),
+    inipp::bind("missing", missing, 42L),
+  };
+
+  // same conversions and defaults as getval, for maps and images alike
+  std::vector<std::uint64_t> buf(cfile.image_size() / 8);
+  cfile.write_image(buf.data());
+  const inipp::inifile image =
+    inipp::inifile::attach(buf.data(), cfile.image_size());
+
+  const inipp::inifile& maps = cfile;
+
+  for(const inipp::inifile* cfg : { &maps, &image }) {
+    BOOST_REQUIRE_EQUAL(cfg->getvals("typed", fields), 4);
+    BOOST_REQUIRE_EQUAL(port, cfg->getval("typed", "port", 0));
+    BOOST_REQUIRE_EQUAL(ratio, 0.5);
+    BOOST_REQUIRE(debug);
+    BOOST_REQUIRE_EQUAL(name, cfg->getval("typed", "name", ""));
+    BOOST_REQUIRE_EQUAL(broken, 7);
+    BOOST_REQUIRE(!fields[4].found && !fields[5].found);
+    BOOST_REQUIRE_EQUAL(missing, 42);
+    BOOST_REQUIRE(cfg->lookup("rule the world", keys) == values);
+  }
+
+  BOOST_REQUIRE_EQUAL(cfile.getvals("nosection", fields), 0);
+  BOOST_REQUIRE(!fields[0].found);
+  BOOST_REQUIRE_EQUAL(port, 8080);
+}
+
+BOOST_AUTO_TEST_CASE( bulk_lookup )
+{
+  std::string text = "top = level\n";
+  for(int s = 0; s < 40; ++s) {
+    text += "[s" + std::to_string(s) + "]\n";
+    for(int k = 0; k < s; ++k) {
+      text += "k" + std::to_string(k) + " = " + std::to_string(s * k) + "\n";
+    }
+  }
+  std::istringstream cstream(text);
+  const inipp::inifile cfile(cstream);
+
+  std::vector<std::uint64_t> buf(cfile.image_size() / 8);
+  cfile.write_image(buf.data());
+  const inipp::inifile image =
+    inipp::inifile::attach(buf.data(), cfile.image_size());
+
+  // spans several prefetch windows, with misses of both kinds
+  std::vector<std::string> names;
+  for(int i = 0; i < 1000; ++i) {
+    names.push_back("s" + std::to_string(i * 7 % 43));
+    names.push_back("k" + std::to_string(i * 13 % 41));
+  }
+  std::vector<inipp::key_ref> keys;
+  for(std::size_t i = 0; i < names.size(); i += 2) {
+    keys.push_back({ names[i], names[i + 1] });
+  }
+  keys.push_back({ "", "top", true });
+  keys.push_back({ "", "nokey", true });
+
+  for(const inipp::inifile* cfg : { &cfile, &image }) {
+    const auto values = cfg->lookup(keys);
+    BOOST_REQUIRE_EQUAL(values.size(), keys.size());
+
+    std::size_t found = 0;
+    for(std::size_t i = 0; i + 2 < keys.size(); ++i) {
+      const std::string want = cfg->dget(std::string(keys[i].section),
+                                         std::string(keys[i].key), "-");
+      BOOST_REQUIRE_EQUAL(values[i] ? std::string(*values[i]) : "-", want);
+      found += bool(values[i]);
+    }
+    BOOST_REQUIRE(found > 0 && found < keys.size() - 2);
+    BOOST_REQUIRE(values[keys.size() - 2] &&
+                  *values[keys.size() - 2] == "level");
+    BOOST_REQUIRE(!values.back());
+  }
+}
+
+BOOST_AUTO_TEST_CASE( compact_storage )
+{
+  // random churn of short (inline) and long (pooled) strings, checked
+  // against a plain map
+  inipp::inifile cfile;
+  std::map<std::string, std::string> model;
+  std::uint64_t x = 2463534242;
+
+  for(int i = 0; i < 20000; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    const std::string key = std::string(x % 3 ? 3 : 20, 'k') +
+                            std::to_string(x % 300);
+    const std::string value = std::string((x >> 8) % 40, 'v') +
+                              std::to_string(i);
+
+    if((x >> 16) % 4 == 0) {
+      BOOST_REQUIRE_EQUAL(cfile.erase("s", key), model.erase(key) == 1);
+    }
+    else {
+      cfile.set("s", key, value);
+      model[key] = value;
+    }
+  }
+
+  for(const auto& kv : model) {
+    BOOST_REQUIRE_EQUAL(cfile.get("s", kv.first), kv.second);
+  }
+
+  inipp::inifile fresh;
+  fresh.set("s", "", "");
+  fresh.erase("s", "");
+  for(const auto& kv : model) {
+    fresh.set("s", kv.first, kv.second);
+  }
+  BOOST_REQUIRE(inipp::diff(fresh, cfile).empty());
+  BOOST_REQUIRE(fresh.fingerprint() == cfile.fingerprint());
+}
+
+BOOST_AUTO_TEST_CASE( typed_values )
+{
+  const char* values[] = {
+    "42", "-7", "+5", "007", "0", "-0", "+0", "1e3", "1.5", "-2.5e-3", ".5",
+    "5.", "1E+2", "true", "false", "True", "1", "0x10", "70000", "-70000",
+    "4294967296", "-9223372036854775808", "9223372036854775807",
+    "9223372036854775808", "99999999999999999999", "12345678",
+    "123456789012345678", "1234567a", "12abc", "abc", "1e999", "+-1", "-",
+    ".", "e5", "1e", "1.7976931348623157e308", "9007199254740993"
+  };
+
+  std::string text = "[v]\n";
+  for(std::size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    text += "k" + std::to_string(i) + " = " + values[i] + "\n";
+  }
+  text += "empty =\n";
+
+  std::istringstream pstream(text);
+  const inipp::inifile plain(pstream);
+  inipp::parse_options options;
+  options.typed_values = true;
+  std::istringstream tstream(text);
+  inipp::inifile typed(tstream, options);
+
+  // typed storage must not change what getval returns
+  auto same = [&](const std::string& key) {
+    BOOST_TEST_CONTEXT("key " << key << " = " << plain.dget("v", key, "")) {
+      BOOST_CHECK_EQUAL(typed.getval("v", key, -1),
+                        plain.getval("v", key, -1));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, 3L),
+                        plain.getval("v", key, 3L));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, 9u),
+                        plain.getval("v", key, 9u));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, short(4)),
+                        plain.getval("v", key, short(4)));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, 5ULL),
+                        plain.getval("v", key, 5ULL));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, true),
+                        plain.getval("v", key, true));
+      BOOST_CHECK_EQUAL(typed.getval("v", key, 'c'),
+                        plain.getval("v", key, 'c'));
+
+      const double a = typed.getval("v", key, 0.25);
+      const double b = plain.getval("v", key, 0.25);
+      BOOST_CHECK_EQUAL(std::memcmp(&a, &b, sizeof(a)), 0);
+      BOOST_CHECK_EQUAL(typed.getval("v", key, 0.5f),
+                        plain.getval("v", key, 0.5f));
+    }
+  };
+
+  for(std::size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    same("k" + std::to_string(i));
+  }
+  same("empty");
+  same("missing");
+
+  // and stays in step with modifications
+  typed.set("v", "k0", "2.5");
+  typed.set("v", "new", "17");
+  typed.erase("v", "k1");
+  typed.set("w", "n", "-3");
+  BOOST_REQUIRE_EQUAL(typed.getval("v", "k0", 0.0), 2.5);
+  BOOST_REQUIRE_EQUAL(typed.getval("v", "k0", 0), 0);
+  BOOST_REQUIRE_EQUAL(typed.getval("v", "new", 0), 17);
+  BOOST_REQUIRE_EQUAL(typed.getval("v", "k1", 0), 0);
+  BOOST_REQUIRE_EQUAL(typed.section("w").getval("n", 0), -3);
+  BOOST_REQUIRE_EQUAL(typed.getval("v", "k2", 0), 5);
+}
+
+BOOST_AUTO_TEST_CASE( units )
+{
+  using namespace std::chrono;
+
+  const char* text =
+    "[t]\n"
+    "ms = 250ms\n"
+    "frac = 1.5s\n"
+    "mixed = 1h 30m\n"
+    "packed = 2m30s\n"
+    "micro = 12us\n"
+    "day = 1d\n"
+    "neg = -5min\n"
+    "zero = 0\n"
+    "bare = 30\n"
+    "bad = 5 parsecs\n"
+    "huge = 300000000000h\n"
+    "[s]\n"
+    "plain = 512\n"
+    "bytes = 100B\n"
+    "kilo = 64k\n"
+    "kib = 4GiB\n"
+    "kb = 4GB\n"
+    "frac = 1.5 MiB\n"
+    "max = 15.99EiB\n"
+    "over = 16EiB\n"
+    "neg = -1k\n"
+    "bad = 12 apples\n";
+
+  for(bool typed : { false, true }) {
+    inipp::parse_options options;
+    options.typed_values = typed;
+    std::istringstream cstream(text);
+    const inipp::inifile cfile(cstream, options);
+
+    BOOST_REQUIRE(cfile.getval("t", "ms", 1ms) == 250ms);
+    BOOST_REQUIRE(cfile.getval("t", "ms", 1s) == 0s);
+    BOOST_REQUIRE(cfile.getval("t", "frac", 0ms) == 1500ms);
+    BOOST_REQUIRE(cfile.getval("t", "frac", 0s) == 1s);
+    BOOST_REQUIRE(cfile.getval("t", "mixed", 0min) == 90min);
+    BOOST_REQUIRE(cfile.getval("t", "packed", 0s) == 150s);
+    BOOST_REQUIRE(cfile.getval("t", "micro", 0ns) == 12us);
+    BOOST_REQUIRE(cfile.getval("t", "day", 0h) == 24h);
+    BOOST_REQUIRE(cfile.getval("t", "neg", 0s) == -300s);
+    BOOST_REQUIRE(cfile.getval("t", "zero", 7s) == 0s);
+    BOOST_REQUIRE(cfile.getval("t", "bare", 7s) == 7s);
+    BOOST_REQUIRE(cfile.getval("t", "bad", 7s) == 7s);
+    BOOST_REQUIRE(cfile.getval("t", "huge", 7s) == 7s);
+    BOOST_REQUIRE(cfile.getval("t", "missing", 7s) == 7s);
+    BOOST_REQUIRE(cfile.section("t").getval("ms", 0.0s) ==
+                  duration<double>(0.25));
+    BOOST_REQUIRE(cfile.getval("t", "day", duration<std::int8_t>(1)) ==
+                  duration<std::int8_t>(1));
+
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "plain", 0), 512);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "bytes", 0), 100);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "kilo", 0), 64 << 10);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "kib", 0), 4ULL << 30);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "kb", 0), 4000000000ULL);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "frac", 0), 3 << 19);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "max", 0),
+                        15 * (1ULL << 60) + 1141392289560778506ULL);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "over", 1), 1);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "neg", 1), 1);
+    BOOST_REQUIRE_EQUAL(cfile.getsize("s", "bad", 1), 1);
+    BOOST_REQUIRE_EQUAL(cfile.section("s").getsize("kilo", 0), 65536);
+
+    // units do not leak into the other kind
+    BOOST_REQUIRE_EQUAL(cfile.getsize("t", "ms", 1), 1);
+    BOOST_REQUIRE(cfile.getval("s", "kilo", 1s) == 1s);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( environment_overlay )
+{
+  const char* text =
+    "name = app\n"
+    "[limits]\n"
+    "max_inflight = 64\n"
+    "timeout = 5s\n";
+  char vars[][40] = {
+    "PATH=/usr/bin",
+    "APP__LIMITS__MAX_INFLIGHT= 128 ",
+    "APP__LIMITS__TIMEOUT=5s",
+    "APP__NAME=svc",
+    "APP__CACHE__SIZE=4MiB",
+    "APP__LIMITS__=skipped",
+    "APPX__NAME=skipped",
+    "APP_NAME=skipped",
+    "APP__BROKEN",
+  };
+  char* envp[] = { vars[0], vars[1], vars[2], vars[3], vars[4], vars[5],
+                   vars[6], vars[7], vars[8], nullptr };
+
+  for(bool typed : { false, true }) {
+    inipp::parse_options options;
+    options.typed_values = typed;
+    std::istringstream cstream(text);
+    inipp::inifile cfile(cstream, options);
+
+    // nothing is tracked before the first overlay
+    BOOST_REQUIRE(cfile.origin("name").layer ==
+                  inipp::provenance::unknown);
+
+    // without a prefix or a map everything would be imported
+    inipp::env_overlay overlay;
+    BOOST_REQUIRE_THROW(cfile.apply_environment(overlay, envp),
+                        std::invalid_argument);
+    BOOST_REQUIRE(cfile.origin("name").layer ==
+                  inipp::provenance::unknown);
+
+    overlay.prefix = "APP";
+    BOOST_REQUIRE_EQUAL(cfile.apply_environment(overlay, envp), 4);
+
+    BOOST_REQUIRE_EQUAL(cfile.get("limits", "max_inflight"), "128");
+    BOOST_REQUIRE_EQUAL(cfile.getval("limits", "max_inflight", 0), 128);
+    BOOST_REQUIRE_EQUAL(cfile.get("name"), "svc");
+    BOOST_REQUIRE_EQUAL(cfile.getsize("cache", "size", 0), 4 << 20);
+    BOOST_REQUIRE_THROW(cfile.get("limits", ""), inipp::unknown_entry_error);
+
+    BOOST_REQUIRE(cfile.origin("limits", "max_inflight").layer ==
+                  inipp::provenance::environment);
+    BOOST_REQUIRE(cfile.origin("limits", "timeout").layer ==
+                  inipp::provenance::environment);
+    BOOST_REQUIRE(cfile.origin("cache", "size").layer ==
+                  inipp::provenance::environment);
+    BOOST_REQUIRE_THROW(cfile.origin("limits", "missing"),
+                        inipp::unknown_entry_error);
+    BOOST_REQUIRE_THROW(cfile.origin("missing", "name"),
+                        inipp::unknown_section_error);
+
+    cfile.set("limits", "max_inflight", "256");
+    BOOST_REQUIRE(cfile.origin("limits", "max_inflight").layer ==
+                  inipp::provenance::runtime);
+
+    // overridden entries are ordinary entries
+    std::istringstream merged("name = svc\n"
+                              "[limits]\n"
+                              "max_inflight = 256\n"
+                              "timeout = 5s\n"
+                              "[cache]\n"
+                              "size = 4MiB\n");
+    BOOST_REQUIRE(cfile.fingerprint() ==
+                  inipp::inifile(merged).fingerprint());
+  }
+
+  // custom mapping: APP_<SECTION>_<KEY> with single underscores
+  std::istringstream cstream(text);
+  inipp::inifile cfile(cstream);
+  char var[] = "APP_LIMITS_TIMEOUT=9s";
+  char* custom[] = { var, vars[3], nullptr };
+  inipp::env_overlay overlay;
+  overlay.map = [](std::string_view name, std::string& section,
+                   std::string& key, bool& default_section) {
+    if(name.substr(0, 4) != "APP_" || name.find("__") != name.npos) {
+      return false;
+    }
+    name.remove_prefix(4);
+    const std::size_t pos = name.find('_');
+    section = name.substr(0, pos);
+    key = name.substr(pos + 1);
+    std::transform(section.begin(), section.end(), section.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    default_section = false;
+    return true;
+  };
+  BOOST_REQUIRE_EQUAL(cfile.apply_environment(overlay, custom), 1);
+  BOOST_REQUIRE_EQUAL(cfile.get("limits", "timeout"), "9s");
+  BOOST_REQUIRE_EQUAL(cfile.get("name"), "app");
+  BOOST_REQUIRE(cfile.origin("limits", "max_inflight").layer ==
+                inipp::provenance::unknown);
+}
+
+BOOST_AUTO_TEST_CASE( command_line_overrides )
+{
+  std::istringstream cstream("name = app\n"
+                             "[server.http]\n"
+                             "port = 80\n");
+  inipp::inifile cfile(cstream);
+
+  BOOST_REQUIRE_EQUAL(cfile.apply_overrides({ "server.http.port = 8080",
+                                              "name=svc # comment",
+                                              "limits.max=a=b",
+                                              "log.level =" }), 4);
+  BOOST_REQUIRE_EQUAL(cfile.get("server.http", "port"), "8080");
+  BOOST_REQUIRE_EQUAL(cfile.get("name"), "svc");
+  BOOST_REQUIRE_EQUAL(cfile.get("limits", "max"), "a=b");
+  BOOST_REQUIRE_EQUAL(cfile.get("log", "level"), "");
+  BOOST_REQUIRE(cfile.origin("server.http", "port").layer ==
+                inipp::provenance::command_line);
+  BOOST_REQUIRE(cfile.origin("name").layer ==
+                inipp::provenance::command_line);
+
+  // one bad override rejects the whole batch
+  const inipp::digest before = cfile.fingerprint();
+  const std::uint64_t version = cfile.version();
+  for(const char* bad : { "novalue", "[section]", "=value", ".key=v",
+                          "section.=v", "a.b=c\nd=e", "# a.b=c", "" }) {
+    BOOST_REQUIRE_THROW(cfile.apply_overrides({ "name=other", bad }),
+                        inipp::syntax_error);
+  }
+  BOOST_REQUIRE(cfile.fingerprint() == before);
+  BOOST_REQUIRE_EQUAL(cfile.version(), version);
+  BOOST_REQUIRE_EQUAL(cfile.get("name"), "svc");
+}
+
+BOOST_AUTO_TEST_CASE( value_provenance )
+{
+  const char* text =
+    "# comment\n"
+    "name = app\n"
+    "\n"
+    "[server]\n"
+    "port = 80\n"
+    "host = example.org\n"
+    "port = 8080\n";
+
+  inipp::parse_options options;
+  options.track_origins = true;
+  options.file_id = 7;
+  std::istringstream cstream(text);
+  inipp::inifile cfile(cstream, options);
+
+  inipp::provenance from = cfile.origin("name");
+  BOOST_REQUIRE(from.layer == inipp::provenance::file);
+  BOOST_REQUIRE_EQUAL(from.file_id, 7);
+  BOOST_REQUIRE_EQUAL(from.line, 2);
+
+  // the last definition wins
+  from = cfile.origin("server", "port");
+  BOOST_REQUIRE(from.layer == inipp::provenance::file);
+  BOOST_REQUIRE_EQUAL(from.line, 7);
+  BOOST_REQUIRE_EQUAL(cfile.origin("server", "host").line, 6);
+
+  BOOST_REQUIRE_EQUAL(cfile.apply_overrides({ "server.host=localhost",
+                                              "server.port=8080" }), 2);
+  from = cfile.origin("server", "port");
+  BOOST_REQUIRE(from.layer == inipp::provenance::command_line);
+  BOOST_REQUIRE_EQUAL(from.file_id, 0);
+  BOOST_REQUIRE_EQUAL(from.line, 2);
+
+  // origins follow entries moved by erase
+  BOOST_REQUIRE(cfile.erase("server", "host"));
+  BOOST_REQUIRE_EQUAL(cfile.origin("server", "port").line, 2);
+  cfile.set("server", "tls", "on");
+  from = cfile.origin("server", "tls");
+  BOOST_REQUIRE(from.layer == inipp::provenance::runtime);
+  BOOST_REQUIRE_EQUAL(from.line, 0);
+
+  // not tracked by default, nor in images
+  std::istringstream plain(text);
+  const inipp::inifile untracked(plain);
+  BOOST_REQUIRE(untracked.origin("server", "port").layer ==
+                inipp::provenance::unknown);
+
+  std::vector<std::uint64_t> image((cfile.image_size() + 7) / 8);
+  cfile.write_image(image.data());
+  const inipp::inifile attached =
+    inipp::inifile::attach(image.data(), cfile.image_size());
+  BOOST_REQUIRE(attached.origin("server", "port").layer ==
+                inipp::provenance::unknown);
+  BOOST_REQUIRE_THROW(attached.origin("server", "host"),
+                      inipp::unknown_entry_error);
+}
+
+BOOST_AUTO_TEST_CASE( line_endings )
+{
+  const std::string want = "a = 1\n[s]\nb = 2\nc = 3\n";
+  std::istringstream wstream(want);
+  const inipp::inifile expected(wstream);
+
+  for(const char* text : { "a = 1\r\n[s]\r\nb = 2\r\nc = 3\r\n",
+                           "a = 1\r[s]\rb = 2\rc = 3",
+                           "a = 1\r\n[s]\rb = 2\nc = 3\r",
+                           "\xEF\xBB\xBF" "a = 1\n[s]\nb = 2\nc = 3\n",
+                           "\xEF\xBB\xBF" "a = 1\r[s]\r\n\r\nb = 2\rc = 3" }) {
+    // small buffers split CR LF pairs between blocks
+    for(std::size_t size : { 1, 2, 3, 5, 64 }) {
+      inipp::parse_options options;
+      options.buffer_size = size;
+      options.max_line_length = 8;
+      options.track_origins = true;
+      std::istringstream cstream(text);
+      const inipp::inifile cfile(cstream, options);
+      BOOST_REQUIRE(inipp::diff(expected, cfile).empty());
+      BOOST_REQUIRE_EQUAL(cfile.origin("a").line, 1);
+    }
+
+    inipp::inidocument doc{std::string(text)};
+    BOOST_REQUIRE_EQUAL(doc.get("a"), "1");
+    BOOST_REQUIRE_EQUAL(doc.get("s", "c"), "3");
+    BOOST_REQUIRE_EQUAL(doc.str(), text);
+  }
+
+  // CR alone ends a line, so line numbers count it
+  std::istringstream cstream("a = 1\rb = 2\r\nbroken\n");
+  inipp::parse_options options;
+  options.track_origins = true;
+  BOOST_REQUIRE_EXCEPTION(inipp::inifile(cstream, options),
+                          inipp::syntax_error,
+                          [](const inipp::syntax_error& e) {
+                            return std::string(e.what()) ==
+                                   "The line 'broken' is invalid.";
+                          });
+
+  std::istringstream lstream("a = 1\rb = 2\r\nc = 3\n");
+  const inipp::inifile cfile(lstream, options);
+  BOOST_REQUIRE_EQUAL(cfile.origin("c").line, 3);
+
+  // inserted lines use the document's line break
+  inipp::inidocument doc{std::string("a = 1\r[s]\rb = 2\r")};
+  doc.set("s", "d", "4");
+  doc.set("t", "e", "5");
+  BOOST_REQUIRE_EQUAL(doc.str(), "a = 1\r[s]\rb = 2\rd = 4\r\r[t]\re = 5\r");
+}
+
+BOOST_AUTO_TEST_CASE( utf8_validation )
+{
+  inipp::parse_options options;
+  options.validate_utf8 = true;
+
+  std::istringstream good("\xEF\xBB\xBF" "# K\xC3\xA4se\n"
+                          "[stra\xC3\x9F" "e]\n"
+                          "euro = \xE2\x82\xAC\n"
+                          "emoji = \xF0\x9F\x98\x80 and more ascii text\n"
+                          "max = \xF4\x8F\xBF\xBF\n");
+  const inipp::inifile cfile(good, options);
+  BOOST_REQUIRE_EQUAL(cfile.get("stra\xC3\x9F" "e", "euro"), "\xE2\x82\xAC");
+
+  for(std::size_t size : { 1, 2, 3, 5, 7 }) {
+    inipp::parse_options small = options;
+    small.buffer_size = size;
+    small.max_line_length = 40 + size;
+    good.clear();
+    good.seekg(0);
+    BOOST_REQUIRE(inipp::diff(cfile, inipp::inifile(good, small)).empty());
+  }
+
+  // lines before the invalid one are parsed, and the stream is left
+  // behind it
+  std::istringstream partial("a = 1\nb = \xFF\nc = 3\n");
+  std::vector<std::string> keys;
+  BOOST_REQUIRE_THROW(inipp::parse(partial, [&](const inipp::parse_event& ev) {
+                        keys.emplace_back(ev.key);
+                      }, options), inipp::syntax_error);
+  BOOST_REQUIRE(keys == std::vector<std::string>{ "a" });
+  std::string rest;
+  std::getline(partial, rest);
+  BOOST_REQUIRE_EQUAL(rest, "c = 3");
+
+  const std::tuple<const char*, int, int> bad[] = {
+    { "a = b\nkey = \x80\n", 2, 7 },
+    { "key = value\xC0\xAF\n", 1, 12 },
+    { "key = \xE0\x9F\xBF\n", 1, 7 },
+    { "key = \xED\xA0\x80\n", 1, 7 },
+    { "key = \xF4\x90\x80\x80\n", 1, 7 },
+    { "key = \xF5\x80\x80\x80\n", 1, 7 },
+    { "key = \xE2\x82\n", 1, 7 },
+    { "key = \xE2\x82" "a\n", 1, 7 },
+    { "key = \xE2\x82", 1, 7 },
+    { "# 12345678 \xFF\n", 1, 12 },
+  };
+
+  for(const auto& b : bad) {
+    const std::string text = std::get<0>(b);
+
+    // blocks are validated as they are read; padding lines move the
+    // block boundaries through the sequences
+    for(int pad = 0; pad < 8; ++pad) {
+      const std::string message =
+        "Line " + std::to_string(std::get<1>(b) + pad) +
+        " is not valid UTF-8 at byte " + std::to_string(std::get<2>(b)) +
+        ".";
+
+      for(std::size_t maxline : { 24, 1 << 16 }) {
+        options.max_line_length = maxline;
+        std::istringstream cstream(std::string(pad, '\n') + text);
+        BOOST_REQUIRE_EXCEPTION(inipp::inifile(cstream, options),
+                                inipp::syntax_error,
+                                [&](const inipp::syntax_error& e) {
+                                  return e.what() == message;
+                                });
+      }
+    }
+
+    // accepted as plain bytes by default
+    std::istringstream pstream(text);
+    BOOST_REQUIRE_NO_THROW(inipp::inifile{pstream});
+  }
+}
+
+BOOST_AUTO_TEST_CASE( size_hints )
+{
+  std::string text = "top = 1\n";
+  for(int s = 0; s < 50; ++s) {
+    text += "[section " + std::to_string(s) + "]\n";
+    for(int k = 0; k < 10 + 2 * s; ++k) {
+      text += "key " + std::to_string(k) + " = " + std::to_string(k) + "\n";
+    }
+  }
+
+  std::istringstream cstream(text);
+  const inipp::inifile cfile(cstream);
+  const inipp::load_stats& stats = cfile.stats();
+  BOOST_REQUIRE_EQUAL(stats.sections, 50);
+  BOOST_REQUIRE_EQUAL(stats.entries, 1 + 50 * 10 + 49 * 50);
+  BOOST_REQUIRE_EQUAL(stats.largest_section, 108);
+  BOOST_REQUIRE_GT(stats.section_rehashes, 0);
+  BOOST_REQUIRE_GT(stats.entry_rehashes, 0);
+
+  // sized from an earlier load, its image, or by numbers
+  std::vector<std::uint64_t> image((cfile.image_size() + 7) / 8);
+  cfile.write_image(image.data());
+  const inipp::inifile attached =
+    inipp::inifile::attach(image.data(), cfile.image_size());
+
+  for(const inipp::inifile* hint : { &cfile, &attached }) {
+    inipp::parse_options options;
+    options.size_hint = hint;
+    std::istringstream hstream(text);
+    const inipp::inifile hinted(hstream, options);
+    BOOST_REQUIRE(inipp::diff(cfile, hinted).empty());
+    BOOST_REQUIRE_EQUAL(hinted.stats().section_rehashes, 0);
+    BOOST_REQUIRE_EQUAL(hinted.stats().entry_rehashes, 0);
+    BOOST_REQUIRE_EQUAL(hinted.stats().entries, stats.entries);
+  }
+
+  inipp::parse_options options;
+  options.expected_sections = 50;
+  options.expected_entries = 108;
+  std::istringstream estream(text);
+  const inipp::inifile expected(estream, options);
+  BOOST_REQUIRE_EQUAL(expected.stats().section_rehashes, 0);
+  BOOST_REQUIRE_EQUAL(expected.stats().entry_rehashes, 0);
+
+  // only loading is counted
+  inipp::inifile modified(cfile);
+  BOOST_REQUIRE_EQUAL(modified.stats().entries, stats.entries);
+  modified.set("new", "key", "value");
+  BOOST_REQUIRE_EQUAL(modified.stats().sections, 50);
+  BOOST_REQUIRE_EQUAL(inipp::inifile().stats().entries, 0);
+
+  // reloads are sized like the current version
+  inipp::reloadable holder{inipp::inifile(cfile)};
+  std::istringstream rstream(text);
+  holder.reload(rstream);
+  BOOST_REQUIRE_EQUAL(holder.snapshot()->stats().entry_rehashes, 0);
+  BOOST_REQUIRE_EQUAL(holder.snapshot()->stats().section_rehashes, 0);
+}